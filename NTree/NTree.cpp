@@ -25,8 +25,22 @@
 #include "framework.h"
 
 #include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <cstdio>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 #include "NTreeNode.h"
 #include "NTree.h"
+#include "NTreeBufferedIO.h"
+#include "NTreeLock.h"
+#include "NTreeXMLScanner.h"
 #include <crtdbg.h>
 #include "tinyxml2.h"
 
@@ -48,6 +62,37 @@ static bool gImUsingThisMethod = false;
 #endif
 
 
+const NTreeNodeID NTreeNodeRoot::kID;
+
+/* The saves WriteAsync has handed to worker threads.  The workers share it with the
+	tree, so it outlives whichever goes first, and they never touch the tree itself. */
+struct NTree::TreeAsyncSaves
+{
+	std::mutex mutex;
+	std::condition_variable done;			// notified as each save finishes
+	long numRunning;
+	bool failed;							// a save failed since FinishAsyncSaves last waited
+	std::vector<NTreeNodeID> freedIDs;		// IDs the finished saves held, for NewNodeID
+};
+
+/* The branches under the root of a paged tree, in the order of the file's table of contents. */
+struct NTree::TreePageInfo
+{
+	void* file;
+	long version;
+	NTreeNodeReanimateFunc nodeReanimateFunc;
+	NTreeNodeReadCB readCB;
+	long treeOffset;							// where the root's record starts
+	long maxNodes;								// most nodes to keep paged in, 0 for no limit
+	long numPagedInNodes;
+	unsigned long clock;						// ticks once per PageIn
+	std::vector<TreeIndexEntry> entries;
+	NTreeTypeDictionary types;					// from version 7
+	std::vector<NTreeNodePtr> nodes;			// the branch's top node, nullptr once it leaves the root
+	std::vector<unsigned long> lastUse;			// clock at the last PageIn, 0 while still in the file
+	std::unordered_map<NTreeNodePtr, size_t> entryByNode;
+};
+
 // --------------------------------------------------------------------------------
 /*
 	* NTreeNodeRoot
@@ -55,7 +100,6 @@ static bool gImUsingThisMethod = false;
 // --------------------------------------------------------------------------------
 NTreeNodeRoot::NTreeNodeRoot(void) : NTreeNode(NTreeNodeType(NTreeNodeRoot::kType), NTreeNodeID(NTreeNodeRoot::kID))
 {
-	fTree = nullptr;
 }
 
 // --------------------------------------------------------------------------------
@@ -65,7 +109,7 @@ NTreeNodeRoot::NTreeNodeRoot(void) : NTreeNode(NTreeNodeType(NTreeNodeRoot::kTyp
 // --------------------------------------------------------------------------------
 NTreeNodeRoot::NTreeNodeRoot(NTreePtr inTree) : NTreeNode(NTreeNodeType(NTreeNodeRoot::kType), NTreeNodeID(NTreeNodeRoot::kID))
 {
-	fTree = inTree;
+	SetTree(inTree);
 }
 
 // --------------------------------------------------------------------------------
@@ -79,24 +123,58 @@ NTreeNodeRoot::~NTreeNodeRoot()
 
 // --------------------------------------------------------------------------------
 /*
-	* GetTree
+	* GetChild
+
+	If the tree is paged, the child's branch is read in from the file first.
 */
 // --------------------------------------------------------------------------------
-NTreePtr
-NTreeNodeRoot::GetTree() const
+NTreeNodePtr NTreeNodeRoot::GetChild(NTreeChildIndex inIndex)
 {
-	return fTree;
+	NTreePtr
+		tree = GetTree();
+	NTreeNodePtr
+		child = NTreeNode::GetChild(inIndex);
+
+	if ((tree != nullptr) && (child != nullptr) && tree->IsPaged())
+	{
+		tree->PageIn(child);
+	}
+
+	return child;
 }
 
 // --------------------------------------------------------------------------------
 /*
-	* GetTree
+	* CloneForWrite
+
+	As NTreeNode::CloneForWrite, but the copy is an NTreeNodeRoot, as the root
+	of the tree WriteAsync writes must be.
 */
 // --------------------------------------------------------------------------------
-void
-NTreeNodeRoot::SetTree(NTreePtr inTree)
+NTreeNodePtr NTreeNodeRoot::CloneForWrite(long inVersion)
 {
-	fTree = inTree;
+	NTreeNodeRoot*
+		copy = nullptr;
+	NTreeRecordCopy<NTreeNodeRoot>*
+		record = nullptr;
+
+	if (typeid(*this) != typeid(NTreeNodeRoot))
+	{
+		record = new NTreeRecordCopy<NTreeNodeRoot>;
+		if (record->Capture(this, inVersion) != 0)
+		{
+			delete record;
+			record = nullptr;
+		}
+		return record;
+	}
+
+	copy = new NTreeNodeRoot;
+	copy->SetType(GetType());
+	copy->SetID(GetID());
+	copy->SetFlags(GetFlags());
+
+	return copy;
 }
 
 // --------------------------------------------------------------------------------
@@ -109,8 +187,11 @@ NTreeNodeRoot::SetTree(NTreePtr inTree)
 NTree::NTree(void)
 {
 	fRoot = new NTreeNodeRoot(this);
-	fVisitedBits = nullptr;
-	PushVisitedBits();
+	fNextNodeID = NTreeNode::kUnassignedID + 1;
+	fPageInfo = nullptr;
+	fXMLTagDocument = nullptr;
+	fTrackingChanges = false;
+	fThreadSafe = false;
 }
 
 // --------------------------------------------------------------------------------
@@ -122,9 +203,21 @@ NTree::NTree(void)
 // --------------------------------------------------------------------------------
 NTree::NTree(NTreeNodeRoot* inRoot)
 {
+	NTreeChildIndex
+		i;
+
 	fRoot = inRoot;
-	fVisitedBits = nullptr;
-	PushVisitedBits();
+	fRoot->SetTree(this);
+	fNextNodeID = NTreeNode::kUnassignedID + 1;
+	fPageInfo = nullptr;
+	fXMLTagDocument = nullptr;
+	fTrackingChanges = false;
+	fThreadSafe = false;
+
+	for (i = 0; i < fRoot->GetNumChildren(); i += 1)
+	{
+		AttachNodes(fRoot->GetChild(i));
+	}
 }
 
 // --------------------------------------------------------------------------------
@@ -136,61 +229,120 @@ NTree::NTree(NTreeNodeRoot* inRoot)
 // --------------------------------------------------------------------------------
 NTree::~NTree()
 {
-	bool result = true;
+	NTreeChildIndex
+		i;
 
-	result = NTree::VisitAllNTreeNodes(fRoot, NTreeNodeActionFunc(DisposeNTree_ActionFunc), this, kActionOnExit, kEntireTree);
-
-	while (fVisitedBits != nullptr)
-		PopVisitedBits();
+	/* Branches still in the file are empty nodes; they go with the rest. */
+	StopPaging();
 
 	if (fRoot)
 	{
+		for (i = 0; i < fRoot->GetNumChildren(); i += 1)
+		{
+			DisposeBranch(fRoot->GetChild(i), kDisposeTreeGoingAway);
+		}
+		fRoot->SetNumChildren(0);
+
 		delete fRoot;
 		fRoot = nullptr;
 	}
+
+	delete fXMLTagDocument;
+	fXMLTagDocument = nullptr;
+
+	/* Every node made by CreateNode is gone; free their slabs in one go. */
+	fArena.ReleaseAll();
 }
 
 // --------------------------------------------------------------------------------
 /*
-	* DisposeNTreeNode
-
-	Disposes of NodeData then the node itself.
+	* DisposeBranch
+
+	Destroys inStartNode and everything under it, children before parents, in a
+	single pass.  Parents' child arrays are left alone; the caller unhooks
+	inStartNode from its parent.
+
+	Unless inMode is kDisposeTreeGoingAway, the branch must already be detached
+	from the ID table (see DetachNodes).  With kDisposeReleasingIDs each node's
+	ID goes back to the tree for reuse; with kDisposeKeepingIDs it doesn't, since
+	a paged branch comes back from the file with the same IDs.  With
+	kDisposeTreeGoingAway the ID table is left as is, and nodes from CreateNode
+	are only destructed, since the arena is about to free their slabs wholesale.
 */
 // --------------------------------------------------------------------------------
-bool
-NTree::DisposeNTree_ActionFunc
+void
+NTree::DisposeBranch
 (
-	NTreeNodePtr
-	inNode,
-	void*
-	inTree
+	NTreeNodePtr inStartNode,
+	DisposeMode inMode
 )
 {
-	long
-		error = 0;
-	NTreePtr
-		tree = NTreePtr(inTree);
+	NTreeTraversalContextHolder
+		holder;
+	NTreeTraversalContext&
+		context = *holder;
+	NTreeNodePtr
+		node = nullptr;
+	NTreeNodeID
+		id = NTreeNode::kUnassignedID;
 
-	if (tree->IsRoot(inNode) == false)
+	context.Push(inStartNode, 0, 0);
+
+	while (!context.IsEmpty())
 	{
-		NTreeNodePtr
-			parent = inNode->GetParent();
+		NTreeTraversalFrame&
+			top = context.Top();
 
-		if (parent != nullptr)
+		if (top.nextChild < top.node->GetNumChildren())
 		{
-			error = parent->RemoveChild(inNode);
-			delete inNode;
+			node = top.node->GetChild(static_cast<NTreeChildIndex>(top.nextChild));
+			top.nextChild += 1;
+
+			/* Push may move the frames, so top isn't used after this. */
+			context.Push(node, 0, 0);
+			continue;
 		}
-	}
 
-	return (error == 0) ? false : true;
+		node = top.node;
+		context.Pop();
+
+		/* The children are gone already. */
+		node->SetNumChildren(0);
+
+		if (inMode == kDisposeTreeGoingAway)
+		{
+			if (node->GetArena() == &fArena)
+			{
+				node->~NTreeNode();
+			}
+			else
+			{
+				DeleteNode(node);
+			}
+		}
+		else
+		{
+			id = node->GetID();
+			DeleteNode(node);
+			if (inMode == kDisposeReleasingIDs)
+			{
+				ReleaseNodeID(id);
+			}
+		}
+	}
 }
 
 // --------------------------------------------------------------------------------
 /*
 	* Read
 
-	Returns true if an error occurred.
+	Replaces the tree with the one in inFile.  inReadCB is called for large
+	blocks by a NTreeBufferedReader, and the nodes read their fields from
+	memory.  A table of contents written by WriteIndexed is skipped, and the
+	tree is read with the version it records rather than inVersion.
+
+	Returns true if an error occurred, or if inVersion is newer than
+	kNTreeVersion.
 */
 // --------------------------------------------------------------------------------
 long
@@ -203,660 +355,2796 @@ NTree::Read
 	NTreeNodeReadCB inReadCB
 )
 {
+	NTreeWriteLock lock(this);
 	long error = 0;
-	TreeReadInfo info;
+	long offset = ioOffset;
+	long version = inVersion;
+	TreeIndexHeader header;
+	std::vector<TreeIndexEntry> entries;
+	NTreeTypeDictionary types;
 
-	info.file = inFile;
-	info.offset = ioOffset;
-	info.version = inVersion;
-	info.nodeReanimateFunc = inNodeReanimateFunc;
-	info.root = fRoot;
-	info.readCB = inReadCB;
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+	/* A version this build doesn't know how to read. */
+	if (static_cast<unsigned long>(inVersion) > kNTreeVersion)
+	{
+		return true;
+	}
+
+	if (ReadIndex(inFile, ioOffset, inReadCB, header, entries) == 0)
+	{
+		offset += long(sizeof(TreeIndexHeader) + entries.size() * sizeof(TreeIndexEntry));
+		version = long(header.version);
+	}
+
+	if (static_cast<unsigned long>(version) >= kNTreeVersion700)
+	{
+		error = types.Read(inFile, offset, inReadCB);
+		if (error != 0)
+		{
+			ioOffset = offset;
+			return error;
+		}
+	}
 
-	while (fRoot->GetNumChildren() > 0)
-		fRoot->RemoveChild(static_cast<short>(0));
+	/* Throw away the current tree. */
+	fTrackingChanges = false;
+	Prune(fRoot);
 
 	/* The NewNTree() function sets the node id to kNTreeRootID.  The ReadNTreeNode() function
 	needs this to be changed to work correctly. */
 	fRoot->SetID(NTreeNode::kUnassignedID);
 
-	VisitAllNTreeNodes(fRoot, NTreeNodeActionFunc(ReadNTreeNode_ActionFunc), &info, kActionOnEntry, kEntireTree);
+	error = ReadBranch(fRoot, inFile, offset, version, inNodeReanimateFunc, inReadCB, (static_cast<unsigned long>(version) >= kNTreeVersion700) ? &types : nullptr);
+	if (error == 0)
+	{
+		StartTrackingChanges();
+	}
 
-	ioOffset = info.offset;
+	ioOffset = offset;
 
 	return error;
 }
 
 // --------------------------------------------------------------------------------
 /*
-	* ReadNTreeNode
+	* ReadBranch
 
-	Returns true if an error occurred.
+	Reads inNode, which has just been made from its type, and everything under
+	it, starting at ioOffset.  On exit ioOffset is just past the branch.
+	inTypes is the file's type dictionary from version 7, nullptr before.
+
+	Returns 0 if no error.
 */
 // --------------------------------------------------------------------------------
-bool
-NTree::ReadNTreeNode_ActionFunc
+long
+NTree::ReadBranch
 (
 	NTreeNodePtr inNode,
-	TreeReadInfo* inInfo
+	void* inFile,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB,
+	const NTreeTypeDictionary* inTypes
 )
 {
-	long
-		error = 0;
+	long error = 0;
+	TreeReadInfo info;
+	NTreeBufferedReader reader(inFile, inReadCB);
 
-	if (inNode->GetID() == NTreeNode::kUnassignedID)
+	if (static_cast<unsigned long>(inVersion) >= kNTreeVersion700)
 	{
-		error = inNode->Read(inInfo->file, inInfo->offset, inInfo->version, inInfo->nodeReanimateFunc, inInfo->readCB);
-		if (error != 0)
+		if (inTypes == nullptr)
 		{
-			goto ErrorExit;
+			return -1;
 		}
+		return ReadCompactBranch(inNode, &reader, ioOffset, inVersion, inNodeReanimateFunc, NTreeBufferedReader::ReadCB, *inTypes);
 	}
 
-ErrorExit:
-	return (error == 0) ? false : true;
+	info.file = &reader;
+	info.offset = ioOffset;
+	info.version = inVersion;
+	info.nodeReanimateFunc = inNodeReanimateFunc;
+	info.root = inNode;
+	info.readCB = NTreeBufferedReader::ReadCB;
+
+	if (VisitAllNTreeNodes(inNode, NTreeNodeActionFunc(ReadNTreeNode_ActionFunc), &info, kActionOnEntry, kJustThisBranch))
+	{
+		error = -1;
+	}
+
+	ioOffset = info.offset;
+
+	return error;
 }
 
 // --------------------------------------------------------------------------------
 /*
-	* Write
+	* ReadCompactBranch
 
-	Returns true if an error occurred.
+	ReadBranch for version 7, where each record starts with its type's index in
+	inTypes and leaves out the types of its children.  The children are made
+	as their records are reached, so the branch is read depth first with a
+	stack of the nodes whose children are still being read.
+
+	If an error occurs, the branch is cut back to the nodes that were made,
+	so it can be disposed of as usual.
+
+	Returns 0 if no error.
 */
 // --------------------------------------------------------------------------------
 long
-NTree::Write
+NTree::ReadCompactBranch
 (
+	NTreeNodePtr inNode,
 	void* inFile,
 	long& ioOffset,
 	long inVersion,
-	NTreeNodeWriteCB inWriteCB
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB,
+	const NTreeTypeDictionary& inTypes
 )
 {
+	struct BranchFrame
+	{
+		NTreeNodePtr node;
+		NTreeChildIndex next;		// the next child to read
+	};
+
 	long
 		error = 0;
-	TreeWriteInfo
-		info;
-
-
-	info.file = inFile;
-	info.offset = ioOffset;
-	info.version = inVersion;
-	info.root = fRoot;
-	info.writeCB = inWriteCB;
+	NTreeNodeType
+		type = 0;
+	NTreeNodePtr
+		parent = nullptr;
+	NTreeNodePtr
+		child = nullptr;
+	NTreeNodePtr
+		partial = nullptr;
+	std::vector<BranchFrame>
+		frames;
+	size_t
+		i;
+
+	error = inTypes.ReadType(inFile, ioOffset, inReadCB, type);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+	if (inNode->GetType() != type)
+	{
+		inNode->SetType(type);
+	}
 
-	if (VisitAllNTreeNodes(fRoot, WriteNTreeNode_ActionFunc, &info, kActionOnEntry, kEntireTree))
+	error = inNode->Read(inFile, ioOffset, inVersion, inNodeReanimateFunc, inReadCB);
+	if (error != 0)
 	{
+		partial = inNode;
 		goto ErrorExit;
 	}
+	frames.push_back({ inNode, 0 });
 
-ErrorExit:
-	ioOffset = info.offset;
-	return ((error == 0) ? false : true);
-}
+	while (!frames.empty())
+	{
+		parent = frames.back().node;
+		if (frames.back().next >= parent->GetNumChildren())
+		{
+			frames.pop_back();
+			continue;
+		}
 
-// --------------------------------------------------------------------------------
-/*
-	* WriteNTreeNode_ActionFunc
+		error = inTypes.ReadType(inFile, ioOffset, inReadCB, type);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
 
-	Returns true if an error occurred.
-*/
-// --------------------------------------------------------------------------------
-bool NTree::WriteNTreeNode_ActionFunc(NTreeNodePtr inNode, void* inInfo)
-{
-	long error = 0;
-	TreeWriteInfo* info = static_cast<TreeWriteInfo*>(inInfo);
+		child = (*inNodeReanimateFunc)(type, 0);
+		if (child == nullptr)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
 
-	error = inNode->Write(info->file, info->offset, info->version, info->writeCB);
+		/* The child's ID is read relative to its parent's, so it is linked in first. */
+		parent->SetChild(frames.back().next, child);
+		child->SetParent(parent);
+		frames.back().next += 1;
+		if (parent->GetTree() != nullptr)
+		{
+			parent->GetTree()->AttachNodes(child);
+		}
 
-	return (error == 0) ? false : true;
-}
+		error = child->Read(inFile, ioOffset, inVersion, inNodeReanimateFunc, inReadCB);
+		if (error != 0)
+		{
+			partial = child;
+			goto ErrorExit;
+		}
+		frames.push_back({ child, 0 });
+	}
+
+ErrorExit:
+	if (error != 0)
+	{
+		/* Drop the slots that were never filled. */
+		if (partial != nullptr)
+		{
+			partial->SetNumChildren(0);
+		}
+		for (i = 0; i < frames.size(); i += 1)
+		{
+			frames[i].node->SetNumChildren(frames[i].next);
+		}
+	}
 
+	return error;
+}
 
 // --------------------------------------------------------------------------------
 /*
-	ReadXML
+	* ReadRoot
 
-	Returns true if an error occurred.
+	Reads just the root's record at ioOffset, for ReadIndexed and OpenPaged.
+	Its children come back as empty nodes of the right type, one for each of
+	inEntries; from version 7 the types are read from the start of each branch.
+
+	Returns 0 if no error.
 */
 // --------------------------------------------------------------------------------
 long
-NTree::ReadXML
+NTree::ReadRoot
 (
-	const char* inFilename,
+	void* inFile,
 	long& ioOffset,
 	long inVersion,
-	NTreeNodeReanimateXMLFunc inNodeReanimateXMLFunc,
-	NTreeNodeReadCB inReadCB
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB,
+	long inTreeOffset,
+	const std::vector<TreeIndexEntry>& inEntries,
+	const NTreeTypeDictionary* inTypes
 )
 {
-	long error = 0;
-	XMLDocument* document = new XMLDocument();
-	XMLElement* rootElement = NULL;
+	long
+		error = 0;
+	NTreeBufferedReader
+		reader(inFile, inReadCB);
+	NTreeNodeType
+		type = 0;
+	NTreeNodePtr
+		child = nullptr;
+	long
+		branchOffset = 0;
+	NTreeChildIndex
+		i = 0;
 
-	error = document->LoadFile(inFilename);
-	if (error != 0) { goto ErrorExit; }
+	if (inTypes != nullptr)
+	{
+		error = inTypes->ReadType(&reader, ioOffset, NTreeBufferedReader::ReadCB, type);
+		if ((error == 0) && (fRoot->GetType() != type))
+		{
+			fRoot->SetType(type);
+		}
+	}
 
-	TreeReadInfo info;
-	info.file = nullptr;
-	info.offset = ioOffset;
-	info.version = inVersion;
-	info.nodeReanimateXMLFunc = inNodeReanimateXMLFunc;
-	info.root = fRoot;
-	info.readCB = inReadCB;
+	if (error == 0)
+	{
+		error = fRoot->Read(&reader, ioOffset, inVersion, inNodeReanimateFunc, NTreeBufferedReader::ReadCB);
+	}
+	if ((error == 0) && (size_t(fRoot->GetNumChildren()) != inEntries.size()))
+	{
+		error = -1;
+	}
+	if ((error != 0) || (inTypes == nullptr))
+	{
+		goto ErrorExit;
+	}
 
-	while (fRoot->GetNumChildren() > 0)
-		fRoot->RemoveChild(static_cast<short>(0));
+	for (i = 0; i < fRoot->GetNumChildren(); i += 1)
+	{
+		branchOffset = inTreeOffset + long(inEntries[size_t(i)].offset);
+		error = inTypes->ReadType(&reader, branchOffset, NTreeBufferedReader::ReadCB, type);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
 
-	/* The NewNTree() function sets the node id to kNTreeRootID.  The ReadNTreeNode() function
-	needs this to be changed to work correctly. */
-	fRoot->SetID(NTreeNode::kUnassignedID);
+		child = (*inNodeReanimateFunc)(type, 0);
+		if (child == nullptr)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
 
-	rootElement = document->RootElement();
-	if (rootElement != nullptr)
-	{
-		error = CreateNTreeNodeFromXMLElement(GetRoot(), &info, rootElement);
+		fRoot->SetChild(i, child);
+		child->SetParent(fRoot);
+		if (fRoot->GetTree() != nullptr)
+		{
+			fRoot->GetTree()->AttachNodes(child);
+		}
 	}
 
 ErrorExit:
+	if ((error != 0) && (inTypes != nullptr))
+	{
+		/* Drop the slots that were never filled. */
+		fRoot->SetNumChildren(i);
+	}
+
 	return error;
 }
 
 // --------------------------------------------------------------------------------
 /*
-  PopulateNTreeNodeFromXMLElement
+	* ReadIndex
+
+	Reads the table of contents at inOffset into outHeader and outEntries.
+
+	Returns 0 if no error, or non-zero if there is no table there.
 */
 // --------------------------------------------------------------------------------
-long NTree::CreateNTreeNodeFromXMLElement(NTreeNode* inParent, TreeReadInfo* inTreeInfo, XMLElement* inXMLElement)
+long
+NTree::ReadIndex
+(
+	void* inFile,
+	long inOffset,
+	NTreeNodeReadCB inReadCB,
+	TreeIndexHeader& outHeader,
+	std::vector<TreeIndexEntry>& outEntries
+)
 {
-	long error = 0;
+	long
+		error = 0;
+	uint32_t
+		magic = 0;
+
+	outEntries.clear();
 
-	if ((inParent == nullptr) || (inTreeInfo == nullptr) || (inXMLElement == nullptr))
+	/* A tree without a table starts with the root's type, which is never kIndexMagic. */
+	error = (*inReadCB)(inFile, &magic, sizeof(magic), 1, inOffset);
+	if ((error != 0) || (magic != uint32_t(kIndexMagic)))
 	{
 		error = -1;
 		goto ErrorExit;
 	}
 
-	if (inXMLElement->NoChildren())
+	error = (*inReadCB)(inFile, &outHeader, sizeof(outHeader), 1, inOffset);
+	if ((error != 0) || (outHeader.version > kNTreeVersion))
 	{
-		XMLElement* siblingElement = inXMLElement->NextSiblingElement();
-		if (siblingElement != nullptr)
-		{
-			NTreeNodePtr sibling = (*(inTreeInfo->nodeReanimateXMLFunc))(siblingElement);
-			inParent->InsertChild(sibling);
-			error = CreateNTreeNodeFromXMLElement(sibling, inTreeInfo, siblingElement);
-		}
+		error = -1;
+		goto ErrorExit;
 	}
-	else
+
+	outEntries.resize(outHeader.numEntries);
+	if (!outEntries.empty())
 	{
-		XMLElement* childElement = inXMLElement->FirstChildElement();
-		NTreeNodePtr child = (*(inTreeInfo->nodeReanimateXMLFunc))(childElement);
-		inParent->InsertChild(child);
-		error = CreateNTreeNodeFromXMLElement(child, inTreeInfo, childElement);
+		error = (*inReadCB)(inFile, outEntries.data(), static_cast<unsigned long>(outEntries.size() * sizeof(TreeIndexEntry)), 1, inOffset + long(sizeof(outHeader)));
 	}
 
 ErrorExit:
 	return error;
 }
 
-
 // --------------------------------------------------------------------------------
 /*
-  WriteXML
-*/
-// --------------------------------------------------------------------------------
-long NTree::WriteXML(const char*, long&, long, NTreeNodeWriteCB)
-{
-	return 0;
-}
+	* ReadIndexed
 
+	Replaces the tree with the one in inFile, written by WriteIndexed.  The
+	root is read first; then the branches under it are read at once by
+	inNumThreads threads (0 for one per core), each starting at the branch's
+	offset in the table of contents.  A tree without a table is read by Read.
+	The tree is read with the version the table records, not inVersion.
 
-// --------------------------------------------------------------------------------
+	inReadCB and inNodeReanimateFunc are called from several threads at once and
+	must allow it: reading with pread or from memory, say, not with a seek
+	followed by a read.
+
+	Returns true if an error occurred, or if inVersion is newer than
+	kNTreeVersion.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::ReadIndexed
+(
+	void* inFile,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB,
+	unsigned int inNumThreads
+)
+{
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	TreeIndexHeader
+		header;
+	std::vector<TreeIndexEntry>
+		entries;
+	NTreeTypeDictionary
+		types;
+	std::vector<long>
+		errors;
+	std::atomic<size_t>
+		nextEntry(0);
+	std::vector<std::thread>
+		threads;
+	unsigned int
+		numThreads = (inNumThreads > 0) ? inNumThreads : std::thread::hardware_concurrency();
+	long
+		treeOffset = 0;
+	long
+		offset = 0;
+	long
+		version = 0;
+	size_t
+		i;
+
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+	/* A version this build doesn't know how to read. */
+	if (static_cast<unsigned long>(inVersion) > kNTreeVersion)
+	{
+		return true;
+	}
+
+	if (ReadIndex(inFile, ioOffset, inReadCB, header, entries) != 0)
+	{
+		return Read(inFile, ioOffset, inVersion, inNodeReanimateFunc, inReadCB);
+	}
+
+	/* The file says how it was written. */
+	version = long(header.version);
+
+	treeOffset = ioOffset + long(sizeof(TreeIndexHeader) + entries.size() * sizeof(TreeIndexEntry));
+	offset = treeOffset;
+
+	fTrackingChanges = false;
+	Prune(fRoot);
+	fRoot->SetID(NTreeNode::kUnassignedID);
+
+	/* With the root out of the tree, the branches are built outside the ID table,
+		so the threads share nothing.  They are added to the table at the end. */
+	fRoot->SetTree(nullptr);
+
+	if (static_cast<unsigned long>(version) >= kNTreeVersion700)
+	{
+		error = types.Read(inFile, offset, inReadCB);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+	}
+
+	/* Just the root; its children come back as empty nodes for the threads to fill. */
+	error = ReadRoot(inFile, offset, version, inNodeReanimateFunc, inReadCB, treeOffset, entries, (static_cast<unsigned long>(version) >= kNTreeVersion700) ? &types : nullptr);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	{
+		auto
+			readBranches = [&](void)
+			{
+				size_t
+					entry;
+
+				while ((entry = nextEntry++) < entries.size())
+				{
+					long
+						branchOffset = treeOffset + long(entries[entry].offset);
+
+					errors[entry] = ReadBranch(fRoot->GetChild(static_cast<NTreeChildIndex>(entry)), inFile, branchOffset, version, inNodeReanimateFunc, inReadCB, (static_cast<unsigned long>(version) >= kNTreeVersion700) ? &types : nullptr);
+				}
+			};
+
+		errors.assign(entries.size(), 0);
+
+		if (numThreads == 0)
+		{
+			numThreads = 1;
+		}
+		if (numThreads > entries.size())
+		{
+			numThreads = static_cast<unsigned int>(entries.size());
+		}
+
+		/* This thread is one of them. */
+		for (i = 1; i < numThreads; i += 1)
+		{
+			threads.push_back(std::thread(readBranches));
+		}
+		readBranches();
+		for (i = 0; i < threads.size(); i += 1)
+		{
+			threads[i].join();
+		}
+	}
+
+	for (i = 0; i < errors.size(); i += 1)
+	{
+		if (errors[i] != 0)
+		{
+			error = errors[i];
+		}
+	}
+
+ErrorExit:
+	fRoot->SetTree(this);
+	for (i = 0; i < size_t(fRoot->GetNumChildren()); i += 1)
+	{
+		AttachNodes(fRoot->GetChild(static_cast<NTreeChildIndex>(i)));
+	}
+
+	if (error == 0)
+	{
+		StartTrackingChanges();
+	}
+
+	ioOffset = treeOffset + long(header.treeSize);
+
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* OpenPaged
+
+	Replaces the tree with the one in inFile, written by WriteIndexed, reading
+	only the root.  Each branch under the root is an empty node until it is
+	first reached through the root's GetChild, or by PageIn, and is then read
+	from its offset in the table of contents.  inFile and inReadCB are kept
+	and must stay usable until the tree is read again or goes away.
+
+	If inMaxNodes isn't 0, the least recently paged in branches are paged out
+	again to keep the number of nodes read in at or below it.  A branch larger
+	than that is still read in whole.
+
+	Paging is not thread safe, and fails on a tree made thread-safe by
+	SetThreadSafe.  It has these limits:
+
+		- A paged out branch is read back as it is in the file; changes made
+		  to it while it was in are lost, and pointers into it are left
+		  dangling.  Call PageInAll before editing the tree.
+		- FindNodeByID only finds nodes that are paged in.
+		- Nodes created meanwhile get IDs above every ID in the file.
+
+	The tree is read with the version the table of contents records; inVersion
+	only has to be one this build can read.
+
+	Returns true if an error occurred, if the file has no table of contents, or
+	if inVersion is newer than kNTreeVersion.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::OpenPaged
+(
+	void* inFile,
+	long inOffset,
+	long inVersion,
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB,
+	long inMaxNodes
+)
+{
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	TreeIndexHeader
+		header;
+	std::vector<TreeIndexEntry>
+		entries;
+	NTreeTypeDictionary
+		types;
+	long
+		treeOffset = 0;
+	long
+		offset = 0;
+	long
+		version = 0;
+	TreePageInfo*
+		info = nullptr;
+	NTreeNodePtr
+		node = nullptr;
+	size_t
+		i;
+
+	/* Paging changes the tree as it is read, so readers can't share it. */
+	if ((lock.GetError() != 0) || fThreadSafe)
+	{
+		return true;
+	}
+
+	/* A version this build doesn't know how to read. */
+	if (static_cast<unsigned long>(inVersion) > kNTreeVersion)
+	{
+		return true;
+	}
+
+	/* This drops the last file, if the tree was already paged. */
+	fTrackingChanges = false;
+	Prune(fRoot);
+	fRoot->SetID(NTreeNode::kUnassignedID);
+
+	error = ReadIndex(inFile, inOffset, inReadCB, header, entries);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	treeOffset = inOffset + long(sizeof(TreeIndexHeader) + entries.size() * sizeof(TreeIndexEntry));
+	offset = treeOffset;
+	version = long(header.version);
+
+	if (static_cast<unsigned long>(version) >= kNTreeVersion700)
+	{
+		error = types.Read(inFile, offset, inReadCB);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+	}
+
+	/* Just the root; its children come back as empty nodes of the right type. */
+	error = ReadRoot(inFile, offset, version, inNodeReanimateFunc, inReadCB, treeOffset, entries, (static_cast<unsigned long>(version) >= kNTreeVersion700) ? &types : nullptr);
+	if (error != 0)
+	{
+		Prune(fRoot);
+		goto ErrorExit;
+	}
+
+	/* New nodes mustn't take the IDs of nodes still in the file. */
+	fFreeNodeIDs.clear();
+	if (header.maxNodeID >= fNextNodeID)
+	{
+		fNextNodeID = header.maxNodeID + 1;
+	}
+
+	info = new TreePageInfo;
+	info->file = inFile;
+	info->version = version;
+	info->nodeReanimateFunc = inNodeReanimateFunc;
+	info->readCB = inReadCB;
+	info->treeOffset = treeOffset;
+	info->maxNodes = inMaxNodes;
+	info->numPagedInNodes = 0;
+	info->clock = 0;
+	info->entries.swap(entries);
+	for (i = 0; i < types.GetNumTypes(); i += 1)
+	{
+		info->types.Add(types.GetType(i));
+	}
+	info->nodes.resize(info->entries.size(), nullptr);
+	info->lastUse.resize(info->entries.size(), 0);
+
+	for (i = 0; i < info->nodes.size(); i += 1)
+	{
+		node = fRoot->NTreeNode::GetChild(static_cast<NTreeChildIndex>(i));
+		info->nodes[i] = node;
+		info->entryByNode[node] = i;
+	}
+
+	fPageInfo = info;
+
+ErrorExit:
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* PageIn
+
+	Reads inNode's branch in from the file if it is a branch of a paged tree
+	still in the file, paging out others first if the budget requires it.
+	Nodes that are already in memory are only marked as used.
+
+	Returns true if an error occurred.  The branch is left empty if so.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::PageIn(NTreeNodePtr inNode)
+{
+	long
+		error = 0;
+	TreePageInfo*
+		info = fPageInfo;
+	size_t
+		entry = 0;
+	size_t
+		oldest = 0;
+	size_t
+		i;
+	long
+		offset = 0;
+
+	if (info == nullptr)
+	{
+		goto ErrorExit;
+	}
+
+	{
+		auto
+			found = info->entryByNode.find(inNode);
+
+		if (found == info->entryByNode.end())
+		{
+			goto ErrorExit;
+		}
+		entry = found->second;
+	}
+
+	if (info->lastUse[entry] != 0)
+	{
+		info->clock += 1;
+		info->lastUse[entry] = info->clock;
+		goto ErrorExit;
+	}
+
+	/* Make room by paging out the branches used longest ago. */
+	while ((info->maxNodes > 0) && (info->numPagedInNodes + info->entries[entry].numNodes > info->maxNodes))
+	{
+		oldest = info->nodes.size();
+		for (i = 0; i < info->nodes.size(); i += 1)
+		{
+			if ((info->lastUse[i] != 0) && ((oldest == info->nodes.size()) || (info->lastUse[i] < info->lastUse[oldest])))
+			{
+				oldest = i;
+			}
+		}
+		if (oldest == info->nodes.size())
+		{
+			break;
+		}
+
+		PageOut(info->nodes[oldest]);
+	}
+
+	info->clock += 1;
+	info->lastUse[entry] = info->clock;
+	info->numPagedInNodes += long(info->entries[entry].numNodes);
+
+	offset = info->treeOffset + long(info->entries[entry].offset);
+	error = ReadBranch(inNode, info->file, offset, info->version, info->nodeReanimateFunc, info->readCB, &info->types);
+	if (error != 0)
+	{
+		PageOut(inNode);
+	}
+
+ErrorExit:
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* PageOut
+
+	Frees everything in inNode's branch but inNode itself, which is left as an
+	empty node to be read in again by PageIn.  inNode must be a branch of a
+	paged tree; branches already paged out are left alone.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::PageOut(NTreeNodePtr inNode)
+{
+	long
+		error = 0;
+	TreePageInfo*
+		info = fPageInfo;
+	size_t
+		entry = 0;
+	NTreeNodePtr
+		child = nullptr;
+	NTreeChildIndex
+		i;
+
+	if (info == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	{
+		auto
+			found = info->entryByNode.find(inNode);
+
+		if (found == info->entryByNode.end())
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+		entry = found->second;
+	}
+
+	if (info->lastUse[entry] == 0)
+	{
+		goto ErrorExit;
+	}
+
+	for (i = 0; i < inNode->GetNumChildren(); i += 1)
+	{
+		child = inNode->GetChild(i);
+		DetachNodes(child);
+		DisposeBranch(child, kDisposeKeepingIDs);
+	}
+	inNode->SetNumChildren(0);
+
+	/* kUnassignedID tells ReadBranch to read the node's record again. */
+	inNode->SetID(NTreeNode::kUnassignedID);
+
+	info->lastUse[entry] = 0;
+	info->numPagedInNodes -= long(info->entries[entry].numNodes);
+
+ErrorExit:
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* PageInAll
+
+	Reads in every branch still in the file, ignoring the budget, after which
+	the tree is an ordinary tree.
+
+	Returns true if an error occurred.  The tree stays paged if so.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::PageInAll(void)
+{
+	long
+		error = 0;
+	TreePageInfo*
+		info = fPageInfo;
+	size_t
+		i;
+
+	if (info == nullptr)
+	{
+		goto ErrorExit;
+	}
+
+	info->maxNodes = 0;
+
+	for (i = 0; i < info->nodes.size(); i += 1)
+	{
+		if ((info->nodes[i] != nullptr) && (PageIn(info->nodes[i]) != 0))
+		{
+			error = -1;
+		}
+	}
+
+	if (error == 0)
+	{
+		StopPaging();
+		StartTrackingChanges();
+	}
+
+ErrorExit:
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* GetNumPagedInNodes
+
+	The number of nodes read in by PageIn and not yet paged out, or 0 if the
+	tree isn't paged.
+*/
+// --------------------------------------------------------------------------------
+long NTree::GetNumPagedInNodes(void) const
+{
+	return (fPageInfo != nullptr) ? fPageInfo->numPagedInNodes : 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* StopPaging
+
+	Forgets the file.  Branches still in it stay empty nodes.
+*/
+// --------------------------------------------------------------------------------
+void NTree::StopPaging(void)
+{
+	delete fPageInfo;
+	fPageInfo = nullptr;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* ForgetPage
+
+	inNode is leaving the tree.  If it is a paged branch, it stops being one.
+*/
+// --------------------------------------------------------------------------------
+void NTree::ForgetPage(NTreeNodePtr inNode)
+{
+	size_t
+		entry = 0;
+
+	if (fPageInfo == nullptr)
+	{
+		return;
+	}
+
+	auto
+		found = fPageInfo->entryByNode.find(inNode);
+
+	if (found != fPageInfo->entryByNode.end())
+	{
+		entry = found->second;
+		if (fPageInfo->lastUse[entry] != 0)
+		{
+			fPageInfo->numPagedInNodes -= long(fPageInfo->entries[entry].numNodes);
+		}
+		fPageInfo->nodes[entry] = nullptr;
+		fPageInfo->lastUse[entry] = 0;
+		fPageInfo->entryByNode.erase(found);
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* ReadNTreeNode
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+bool
+NTree::ReadNTreeNode_ActionFunc
+(
+	NTreeNodePtr inNode,
+	TreeReadInfo* inInfo
+)
+{
+	long
+		error = 0;
+
+	if (inNode->GetID() == NTreeNode::kUnassignedID)
+	{
+		error = inNode->Read(inInfo->file, inInfo->offset, inInfo->version, inInfo->nodeReanimateFunc, inInfo->readCB);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+	}
+
+ErrorExit:
+	return (error == 0) ? false : true;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* Write
+
+	The nodes' many small writes are gathered into large chunks by a
+	NTreeBufferedWriter, so inWriteCB is called once per chunk.  Everything
+	has been passed to inWriteCB by the time Write returns.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::Write
+(
+	void* inFile,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeWriteCB inWriteCB
+)
+{
+	bool
+		readingAlready = fThreadSafe && fLock.IsReadLockedByThisThread();
+	NTreeReadLock
+		lock(this);
+	unsigned long
+		writeCount = fLock.GetWriteCount();
+	long
+		error = 0;
+	TreeWriteInfo
+		info;
+	NTreeBufferedWriter
+		writer(inFile, inWriteCB);
+	NTreeTypeDictionary
+		types;
+
+	/* Marking the tree clean afterwards takes the lock exclusive. */
+	if (readingAlready)
+	{
+		return true;
+	}
+
+	info.file = &writer;
+	info.offset = ioOffset;
+	info.version = inVersion;
+	info.root = fRoot;
+	info.writeCB = NTreeBufferedWriter::WriteCB;
+	info.types = nullptr;
+
+	/* From version 7 the types used are listed once, up front. */
+	if (static_cast<unsigned long>(inVersion) >= kNTreeVersion700)
+	{
+		types.AddBranch(fRoot);
+		error = types.Write(info.file, info.offset, info.writeCB);
+		info.types = &types;
+	}
+
+	if ((error == 0) && VisitAllNTreeNodes(fRoot, WriteNTreeNode_ActionFunc, &info, kActionOnEntry, kEntireTree))
+	{
+		error = -1;
+	}
+
+	/* Flush even after an error, so what was written is all there. */
+	if (writer.Flush() != 0)
+	{
+		error = -1;
+	}
+
+	if (error == 0)
+	{
+		lock.Release();
+		FinishSave(writeCount);
+	}
+
+	ioOffset = info.offset;
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* WriteAsync
+
+	Saves the tree as Write (or, if inIndexed, WriteIndexed) would, at inOffset,
+	on a worker thread.  The calling thread only copies the tree, node by node
+	with CloneForWrite, holding the lock exclusive while it does; the copy is
+	encoded and handed to inWriteCB on the worker, while the tree is free to be
+	changed, or even deleted.  The copy takes about as much memory as the tree.
+
+	The future holds the offset just past the save once inWriteCB has taken
+	everything, or -1 if an error occurred.  inFile and inWriteCB are used from
+	the worker thread and must stay usable until then; the future's destructor
+	waits for the worker, so let it go only when the save may be waited on.
+
+	Changes are tracked for WriteDelta from the copy on.  The IDs held since
+	the last save stay held until the save is done.  WriteDelta waits for the
+	saves still running, and fails if any of them failed, as its deltas would
+	have no base to go on; save the tree whole then.
+*/
+// --------------------------------------------------------------------------------
+std::future<long>
+NTree::WriteAsync
+(
+	void* inFile,
+	long inOffset,
+	long inVersion,
+	NTreeNodeWriteCB inWriteCB,
+	bool inIndexed
+)
+{
+	NTreeWriteLock
+		lock(this);
+	NTreePtr
+		copy = nullptr;
+	std::shared_ptr<TreeAsyncSaves>
+		saves;
+	std::vector<NTreeNodeID>
+		heldIDs;
+	std::promise<long>
+		failed;
+
+	if ((lock.GetError() != 0) || (static_cast<unsigned long>(inVersion) > kNTreeVersion))
+	{
+		failed.set_value(-1);
+		return failed.get_future();
+	}
+
+	copy = CopyForWrite(inVersion);
+	if (copy == nullptr)
+	{
+		failed.set_value(-1);
+		return failed.get_future();
+	}
+
+	if (fAsyncSaves == nullptr)
+	{
+		fAsyncSaves = std::make_shared<TreeAsyncSaves>();
+		fAsyncSaves->numRunning = 0;
+		fAsyncSaves->failed = false;
+	}
+	saves = fAsyncSaves;
+
+	{
+		std::lock_guard<std::mutex>
+			guard(saves->mutex);
+
+		saves->numRunning += 1;
+	}
+
+	StartTrackingChanges(&heldIDs);
+
+	return std::async(std::launch::async,
+		[copy, inFile, inOffset, inVersion, inWriteCB, inIndexed, saves, heldIDs = std::move(heldIDs)]()
+		{
+			long
+				offset = inOffset;
+			long
+				error = inIndexed ? copy->WriteIndexed(inFile, offset, inVersion, inWriteCB) : copy->Write(inFile, offset, inVersion, inWriteCB);
+
+			delete copy;
+
+			{
+				std::lock_guard<std::mutex>
+					guard(saves->mutex);
+
+				if (error != 0)
+				{
+					saves->failed = true;
+				}
+				saves->freedIDs.insert(saves->freedIDs.end(), heldIDs.begin(), heldIDs.end());
+				saves->numRunning -= 1;
+			}
+			saves->done.notify_all();
+
+			return (error == 0) ? offset : -1L;
+		});
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* CopyForWrite
+
+	Returns a tree of the nodes' CloneForWrite copies, for WriteAsync to write
+	at inVersion.  The copies are left out of the copy's ID table, as the copy
+	is only written and then deleted.
+
+	Returns nullptr if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+NTreePtr
+NTree::CopyForWrite(long inVersion)
+{
+	NTreeNodePtr
+		rootCopy = fRoot->CloneForWrite(inVersion);
+	NTreePtr
+		copy = nullptr;
+	std::vector<NTreeNodePtr>
+		parents;
+	bool
+		failed = false;
+
+	if (rootCopy == nullptr)
+	{
+		return nullptr;
+	}
+
+	/* NTreeNodeRoot::CloneForWrite always makes a root. */
+	copy = new NTree(static_cast<NTreeNodeRoot*>(rootCopy));
+	rootCopy->SetTree(nullptr);
+
+	failed = VisitAllNTreeNodes(fRoot,
+		[&](NTreeNodePtr inNode)
+		{
+			NTreeNodePtr
+				node = (inNode == fRoot) ? rootCopy : inNode->CloneForWrite(inVersion);
+
+			if (node == nullptr)
+			{
+				return true;
+			}
+			if ((node != rootCopy) && (parents.back()->InsertChild(node) != 0))
+			{
+				delete node;
+				return true;
+			}
+
+			node->ReserveChildren(inNode->GetNumChildren());
+			parents.push_back(node);
+			return false;
+		},
+		[&](NTreeNodePtr inNode)
+		{
+			parents.pop_back();
+			return false;
+		},
+		kEntireTree);
+
+	if (failed)
+	{
+		delete copy;
+		copy = nullptr;
+	}
+
+	return copy;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* WriteNTreeNode_ActionFunc
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+bool NTree::WriteNTreeNode_ActionFunc(NTreeNodePtr inNode, void* inInfo)
+{
+	long error = 0;
+	TreeWriteInfo* info = static_cast<TreeWriteInfo*>(inInfo);
+
+	error = WriteRecord(inNode, info->file, info->offset, info->version, info->writeCB, info->types);
+
+	return (error == 0) ? false : true;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* WriteRecord
+
+	Writes inNode's record.  From version 7, inTypes holds the dictionary, and
+	the node's type goes in front of the record as an index into it.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::WriteRecord
+(
+	NTreeNodePtr inNode,
+	void* inFile,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeWriteCB inWriteCB,
+	const NTreeTypeDictionary* inTypes
+)
+{
+	long
+		error = 0;
+
+	if (inTypes != nullptr)
+	{
+		error = inTypes->WriteType(inFile, ioOffset, inWriteCB, inNode->GetType());
+	}
+
+	if (error == 0)
+	{
+		error = inNode->Write(inFile, ioOffset, inVersion, inWriteCB);
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* WriteIndexed
+
+	Writes the same tree as Write, preceded by a table of contents giving the
+	offset and node count of each branch under the root, so that ReadIndexed
+	can read the branches in parallel.  Read reads it too, skipping the table.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::WriteIndexed
+(
+	void* inFile,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeWriteCB inWriteCB
+)
+{
+	bool
+		readingAlready = fThreadSafe && fLock.IsReadLockedByThisThread();
+	NTreeReadLock
+		lock(this);
+	unsigned long
+		writeCount = fLock.GetWriteCount();
+	long
+		error = 0;
+	NTreeBufferedWriter
+		writer(inFile, inWriteCB);
+	TreeIndexHeader
+		header;
+	std::vector<TreeIndexEntry>
+		entries(size_t(fRoot->GetNumChildren()));
+	long
+		treeOffset = ioOffset + long(sizeof(TreeIndexHeader) + entries.size() * sizeof(TreeIndexEntry));
+	long
+		offset = treeOffset;
+	NTreeTypeDictionary
+		types;
+	const NTreeTypeDictionary*
+		typesUsed = nullptr;
+	NTreeChildIndex
+		i;
+
+	/* Marking the tree clean afterwards takes the lock exclusive. */
+	if (readingAlready)
+	{
+		return true;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = kIndexMagic;
+	header.version = uint32_t(inVersion);
+	header.numEntries = uint32_t(entries.size());
+
+	/* The root, then each branch under it, in the same order Write uses. */
+	if (static_cast<unsigned long>(inVersion) >= kNTreeVersion700)
+	{
+		types.AddBranch(fRoot);
+		error = types.Write(&writer, offset, NTreeBufferedWriter::WriteCB);
+		typesUsed = &types;
+	}
+	if (error == 0)
+	{
+		error = WriteRecord(fRoot, &writer, offset, inVersion, NTreeBufferedWriter::WriteCB, typesUsed);
+	}
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	for (i = 0; i < fRoot->GetNumChildren(); i += 1)
+	{
+		TreeIndexEntry&
+			entry = entries[size_t(i)];
+
+		entry.offset = offset - treeOffset;
+		entry.numNodes = 0;
+
+		if (VisitAllNTreeNodes(fRoot->GetChild(i),
+			[&](NTreeNodePtr inNode)
+			{
+				entry.numNodes += 1;
+				if (inNode->GetID() > header.maxNodeID)
+				{
+					header.maxNodeID = uint32_t(inNode->GetID());
+				}
+				return (WriteRecord(inNode, &writer, offset, inVersion, NTreeBufferedWriter::WriteCB, typesUsed) != 0);
+			},
+			kActionOnEntry, kJustThisBranch))
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+	}
+
+	/* The table goes in front of the tree, now that the offsets are known. */
+	header.treeSize = offset - treeOffset;
+
+	error = writer.Write(&header, sizeof(header), ioOffset);
+	if ((error == 0) && !entries.empty())
+	{
+		error = writer.Write(entries.data(), static_cast<unsigned long>(entries.size() * sizeof(TreeIndexEntry)), ioOffset + long(sizeof(header)));
+	}
+
+ErrorExit:
+	if (writer.Flush() != 0)
+	{
+		error = -1;
+	}
+
+	if (error == 0)
+	{
+		lock.Release();
+		FinishSave(writeCount);
+	}
+
+	ioOffset = offset;
+
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* WriteDelta
+
+	Appends to inFile, at ioOffset, a delta holding only the nodes inserted or
+	changed since the tree was last read or saved, and the parents of nodes
+	removed or moved, so the time taken grows with the edit and not with the
+	tree.  The tree must have been read or saved whole first (Read, ReadIndexed,
+	Write or WriteIndexed), and every node in it needs an ID.
+
+	Each record has to be read on its own, without its parent, so from version 7
+	the records are written as version 6 records.
+
+	Changes made through NTreeNode are noticed by themselves; call MarkDirty
+	after changing data a subclass reads and writes itself.  ReadDeltas applies
+	the deltas to the tree last saved whole.
+
+	Returns true if an error occurred.  After an error, the next save must be
+	a whole one.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::WriteDelta
+(
+	void* inFile,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeWriteCB inWriteCB
+)
+{
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	NTreeBufferedWriter
+		writer(inFile, inWriteCB);
+	TreeDeltaHeader
+		header;
+	long
+		recordsOffset = ioOffset + long(sizeof(TreeDeltaHeader));
+	long
+		offset = recordsOffset;
+	long
+		version = (static_cast<unsigned long>(inVersion) < kNTreeVersion700) ? inVersion : long(kNTreeVersion600);
+	NTreeNodePtr
+		node = nullptr;
+	NTreeNodeID
+		childID = NTreeNode::kUnassignedID;
+	uint32_t
+		id = 0;
+	size_t
+		i;
+	NTreeChildIndex
+		c;
+
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+	/* The deltas follow the last whole save, which may still be being written. */
+	FinishAsyncSaves(true);
+
+	if (!fTrackingChanges)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = kDeltaMagic;
+	header.version = uint32_t(version);
+
+	for (i = 0; i < fDirtyNodeIDs.size(); i += 1)
+	{
+		node = FindNodeByID(fDirtyNodeIDs[i]);
+
+		/* Gone since, or already written. */
+		if ((node == nullptr) || !node->IsDirty())
+		{
+			continue;
+		}
+		node->MarkClean();
+
+		id = (node == fRoot) ? 0xFFFFFFFF : uint32_t(node->GetID());
+		error = writer.Write(&id, sizeof(id), offset);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+		offset += long(sizeof(id));
+
+		error = node->Write(&writer, offset, version, NTreeBufferedWriter::WriteCB);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+
+		for (c = 0; c < node->GetNumChildren(); c += 1)
+		{
+			childID = node->GetChild(c)->GetID();
+			if (childID == NTreeNode::kUnassignedID)
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+
+			id = uint32_t(childID);
+			error = writer.Write(&id, sizeof(id), offset);
+			if (error != 0)
+			{
+				goto ErrorExit;
+			}
+			offset += long(sizeof(id));
+		}
+
+		header.numRecords += 1;
+	}
+
+	/* The header goes in front, now that the size is known. */
+	header.deltaSize = offset - recordsOffset;
+	error = writer.Write(&header, sizeof(header), ioOffset);
+
+ErrorExit:
+	if (writer.Flush() != 0)
+	{
+		error = -1;
+	}
+
+	if (error == 0)
+	{
+		StartTrackingChanges();
+		ioOffset = offset;
+	}
+	else
+	{
+		/* Some nodes may be marked clean without having been written. */
+		fTrackingChanges = false;
+	}
+
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* ReadDeltas
+
+	Applies each delta written by WriteDelta, starting at ioOffset, to the tree,
+	which must be the one they were written after: the tree last saved whole,
+	just read back.  Stops at the first place that doesn't hold a delta; on
+	exit ioOffset is there, ready for the next WriteDelta.
+
+	Compacting is reading the tree and its deltas and then writing the tree
+	whole with Write or WriteIndexed, after which the deltas can be thrown away.
+
+	Returns true if an error occurred.  The tree is left partly updated if so.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::ReadDeltas
+(
+	void* inFile,
+	long& ioOffset,
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB
+)
+{
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	TreeDeltaHeader
+		header;
+	long
+		offset = 0;
+
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+	if (IsPaged())
+	{
+		return true;
+	}
+
+	/* The tree's own changes aren't changes. */
+	fTrackingChanges = false;
+
+	for (;;)
+	{
+		if (((*inReadCB)(inFile, &header, sizeof(header), 1, ioOffset) != 0) || (header.magic != uint32_t(kDeltaMagic)))
+		{
+			break;
+		}
+
+		if (header.version >= kNTreeVersion700)
+		{
+			error = -1;
+			break;
+		}
+
+		NTreeBufferedReader
+			reader(inFile, inReadCB);
+
+		offset = ioOffset + long(sizeof(header));
+		error = ReadDelta(&reader, offset, header, inNodeReanimateFunc, NTreeBufferedReader::ReadCB);
+		if ((error == 0) && (offset != ioOffset + long(sizeof(header)) + long(header.deltaSize)))
+		{
+			error = -1;
+		}
+		if (error != 0)
+		{
+			break;
+		}
+
+		ioOffset = offset;
+	}
+
+	if (error == 0)
+	{
+		StartTrackingChanges();
+	}
+
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* ReadDelta
+
+	Applies one delta's records, starting at ioOffset.  Each node with a record
+	is read again in place, or made if it is new, with empty nodes standing in
+	for its children.  Once every record is in, the stand-ins are replaced by
+	the nodes with the listed IDs, and the nodes no one lists any more are
+	deleted.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::ReadDelta
+(
+	void* inFile,
+	long& ioOffset,
+	const TreeDeltaHeader& inHeader,
+	NTreeNodeReanimateFunc inNodeReanimateFunc,
+	NTreeNodeReadCB inReadCB
+)
+{
+	struct DeltaRecord
+	{
+		NTreeNodePtr node;
+		std::vector<uint32_t> childIDs;
+	};
+
+	long
+		error = 0;
+	long
+		version = long(inHeader.version);
+	std::vector<DeltaRecord>
+		records;
+	std::unordered_map<uint32_t, NTreeNodePtr>
+		looseByID;					// new nodes, and the old children of changed nodes
+	std::vector<NTreeNodePtr>
+		loose;
+	std::vector<NTreeNodePtr>
+		joining;
+	NTreeNodePtr
+		node = nullptr;
+	NTreeNodePtr
+		child = nullptr;
+	NTreeNodePtr
+		standIn = nullptr;
+	NTreeNodeType
+		type = 0;
+	uint32_t
+		id = 0;
+	size_t
+		r;
+	size_t
+		i;
+	NTreeChildIndex
+		c;
+
+	records.resize(inHeader.numRecords);
+
+	for (r = 0; r < records.size(); r += 1)
+	{
+		error = (*inReadCB)(inFile, &id, sizeof(id), 1, ioOffset);
+		if (error == 0)
+		{
+			error = (*inReadCB)(inFile, &type, sizeof(type), 1, ioOffset + long(sizeof(id)));
+		}
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+		ioOffset += long(sizeof(id));
+
+		if (id == 0xFFFFFFFF)
+		{
+			node = fRoot;
+		}
+		else if ((id == NTreeNode::kUnassignedID) || (id >= uint32_t(kNTreeMaxNodeID)))
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+		else
+		{
+			node = FindNodeByID(NTreeNodeID(id));
+		}
+
+		if (node != nullptr)
+		{
+			/* Its children wait, loose, to be hung again under whichever node lists them. */
+			for (c = 0; c < node->GetNumChildren(); c += 1)
+			{
+				child = node->NTreeNode::GetChild(c);
+				child->SetParent(nullptr);
+				looseByID[uint32_t(child->GetID())] = child;
+				loose.push_back(child);
+			}
+			node->SetNumChildren(0);
+		}
+		else
+		{
+			node = (*inNodeReanimateFunc)(type, NTreeNode::kUnassignedID);
+			if (node == nullptr)
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+			looseByID[id] = node;
+			loose.push_back(node);
+		}
+
+		error = node->Read(inFile, ioOffset, version, inNodeReanimateFunc, inReadCB);
+		if ((error == 0) && (node != fRoot) && (node->GetID() != NTreeNodeID(id)))
+		{
+			error = -1;
+		}
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+
+		records[r].node = node;
+		records[r].childIDs.resize(size_t(node->GetNumChildren()));
+		if (!records[r].childIDs.empty())
+		{
+			error = (*inReadCB)(inFile, records[r].childIDs.data(), static_cast<unsigned long>(records[r].childIDs.size() * sizeof(uint32_t)), 1, ioOffset);
+			if (error != 0)
+			{
+				goto ErrorExit;
+			}
+			ioOffset += long(records[r].childIDs.size() * sizeof(uint32_t));
+		}
+	}
+
+	for (r = 0; r < records.size(); r += 1)
+	{
+		node = records[r].node;
+
+		for (c = 0; c < node->GetNumChildren(); c += 1)
+		{
+			id = records[r].childIDs[size_t(c)];
+
+			auto
+				found = looseByID.find(id);
+
+			if (found != looseByID.end())
+			{
+				child = found->second;
+				looseByID.erase(found);
+			}
+			else
+			{
+				/* A node moved out of a parent deleted since, which has no record. */
+				child = FindNodeByID(NTreeNodeID(id));
+				if ((child == nullptr) || (child->GetParent() == nullptr) || (child == fRoot))
+				{
+					error = -1;
+					goto ErrorExit;
+				}
+				child->GetParent()->RemoveChild(child);
+			}
+
+			standIn = node->NTreeNode::GetChild(c);
+			node->SetChild(c, child);
+			child->SetParent(node);
+			DeleteNode(standIn);
+
+			if (child->GetTree() != this)
+			{
+				joining.push_back(child);
+			}
+		}
+	}
+
+	for (i = 0; i < joining.size(); i += 1)
+	{
+		if (joining[i]->GetTree() != this)
+		{
+			AttachNodes(joining[i]);
+		}
+	}
+
+ErrorExit:
+	/* Whatever no one lists any more is gone. */
+	for (i = 0; i < loose.size(); i += 1)
+	{
+		if (loose[i]->GetParent() == nullptr)
+		{
+			if (loose[i]->GetTree() == this)
+			{
+				DetachNodes(loose[i]);
+			}
+			DisposeBranch(loose[i], kDisposeReleasingIDs);
+		}
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* StartTrackingChanges
+
+	The tree has just been read or saved whole, or had its changes saved.
+	Starts afresh with no changes, and frees the IDs held since the last save,
+	or, if outHeldIDs isn't nullptr, hands them over instead for WriteAsync to
+	free once its save is done.
+*/
+// --------------------------------------------------------------------------------
+void NTree::StartTrackingChanges(std::vector<NTreeNodeID>* outHeldIDs)
+{
+	NTreeNodePtr
+		node = nullptr;
+	size_t
+		i;
+
+	for (i = 0; i < fDirtyNodeIDs.size(); i += 1)
+	{
+		node = FindNodeByID(fDirtyNodeIDs[i]);
+		if (node != nullptr)
+		{
+			node->MarkClean();
+		}
+	}
+	fDirtyNodeIDs.clear();
+
+	if (outHeldIDs != nullptr)
+	{
+		outHeldIDs->swap(fHeldNodeIDs);
+	}
+	else
+	{
+		fFreeNodeIDs.insert(fFreeNodeIDs.end(), fHeldNodeIDs.begin(), fHeldNodeIDs.end());
+	}
+	fHeldNodeIDs.clear();
+	FinishAsyncSaves(false);
+
+	/* Paged trees drop changes when they page out, so they have none to save. */
+	fTrackingChanges = !IsPaged();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* FinishSave
+
+	Write or WriteIndexed has saved the tree whole under the lock held shared,
+	and let it go.  inWriteCount is the lock's write count from when the save
+	began.  Takes the lock exclusive to mark the tree clean, unless a writer
+	got in since: what the save caught of its changes can't be told apart, so
+	the tree stops tracking changes until it is next saved whole.
+*/
+// --------------------------------------------------------------------------------
+void NTree::FinishSave(unsigned long inWriteCount)
+{
+	NTreeWriteLock
+		lock(this);
+
+	if (!fThreadSafe || (fLock.GetWriteCount() == inWriteCount))
+	{
+		StartTrackingChanges();
+	}
+	else
+	{
+		fTrackingChanges = false;
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* FinishAsyncSaves
+
+	Frees the IDs held by the saves WriteAsync has finished.  If inWait, first
+	waits for the ones still running, and stops tracking changes if any of them
+	failed: the file holds no base for deltas to follow.
+*/
+// --------------------------------------------------------------------------------
+void NTree::FinishAsyncSaves(bool inWait)
+{
+	std::shared_ptr<TreeAsyncSaves>
+		saves = fAsyncSaves;
+	std::unique_lock<std::mutex>
+		guard;
+
+	if (saves == nullptr)
+	{
+		return;
+	}
+
+	guard = std::unique_lock<std::mutex>(saves->mutex);
+	if (inWait)
+	{
+		saves->done.wait(guard, [&saves](void) { return saves->numRunning == 0; });
+		if (saves->failed)
+		{
+			fTrackingChanges = false;
+			saves->failed = false;
+		}
+	}
+
+	fFreeNodeIDs.insert(fFreeNodeIDs.end(), saves->freedIDs.begin(), saves->freedIDs.end());
+	saves->freedIDs.clear();
+}
+
+
+// --------------------------------------------------------------------------------
+/*
+	ReadXML
+
+	Replaces the tree with the one in the XML file inFilename.  The document's
+	root element stands for the tree's root, and each element inside it
+	becomes a node, made by inNodeReanimateXMLFunc from the element and its
+	attributes; the element's children are not there yet.
+
+	If inNodeReanimateXMLFunc is nullptr the nodes are made through the tree's
+	NTreeXMLTypeTable instead: the function registered for the element's type
+	makes the node, and its ReadXMLAttributes reads the rest.  An element whose
+	type isn't registered is an error.
+
+	The file is read in one forward pass by a NTreeXMLScanner, and a node is
+	made and put under its parent as its start tag is read.  The open elements
+	are kept on a stack, so no document is built and the memory used follows
+	the depth of the tree, not its size.  Only the tag in hand is parsed into
+	an XMLDocument, which the tree keeps, so its memory pools are reused for
+	every element and every load.
+
+	ioOffset, inVersion and inReadCB are not used; the file is read with the
+	C library.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::ReadXML
+(
+	const char* inFilename,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeReanimateXMLFunc inNodeReanimateXMLFunc,
+	NTreeNodeReadCB inReadCB
+)
+{
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	FILE*
+		file = nullptr;
+
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+#ifdef _WIN32
+	if (fopen_s(&file, inFilename, "rb") != 0)
+	{
+		file = nullptr;
+	}
+#else
+	file = fopen(inFilename, "rb");
+#endif
+	if (file == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	{
+		NTreeXMLScanner
+			scanner(file);
+
+		error = ReadXMLElements(scanner, inNodeReanimateXMLFunc);
+	}
+
+ErrorExit:
+	if (file != nullptr)
+	{
+		fclose(file);
+	}
+
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadXML
+
+	Same as above, but the XML is the inSize bytes at inXML: a buffer received
+	or unpacked by the application, or a region of a file it has mapped into
+	memory.  The bytes are scanned where they are, without being copied, and
+	need not end with a null.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::ReadXML
+(
+	const char* inXML,
+	size_t inSize,
+	NTreeNodeReanimateXMLFunc inNodeReanimateXMLFunc
+)
+{
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	NTreeXMLScanner
+		scanner(inXML, inSize);
+
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+	if (inXML == nullptr)
+	{
+		error = -1;
+	}
+	else
+	{
+		error = ReadXMLElements(scanner, inNodeReanimateXMLFunc);
+	}
+
+	return ((error == 0) ? false : true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadXMLElements
+
+	Builds the tree from the tags inScanner reads, for ReadXML.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::ReadXMLElements
+(
+	NTreeXMLScanner& inScanner,
+	NTreeNodeReanimateXMLFunc inNodeReanimateXMLFunc
+)
+{
+	long
+		error = 0;
+	NTreeXMLScanner::Token
+		token = NTreeXMLScanner::kEndOfFile;
+	std::string
+		tag;
+	std::vector<NTreeNodePtr>
+		parents;
+	std::vector<std::string>
+		names;
+	NTreeNodePtr
+		node = nullptr;
+	bool
+		sawRoot = false;
+
+	if (fXMLTagDocument == nullptr)
+	{
+		fXMLTagDocument = new XMLDocument();
+	}
+
+	/* Throw away the current tree.  The root keeps its ID. */
+	fTrackingChanges = false;
+	Prune(fRoot);
+
+	for (;;)
+	{
+		error = inScanner.Next(token);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+
+		if (token == NTreeXMLScanner::kEndOfFile)
+		{
+			/* The root element has to have been read, and closed. */
+			if (!sawRoot || !parents.empty())
+			{
+				error = -1;
+			}
+			break;
+		}
+
+		if (token == NTreeXMLScanner::kEndTag)
+		{
+			if (parents.empty() || (names.back() != inScanner.GetName()))
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+			parents.pop_back();
+			names.pop_back();
+			continue;
+		}
+
+		if (parents.empty())
+		{
+			/* Only one root element. */
+			if (sawRoot)
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+			sawRoot = true;
+			node = fRoot;
+		}
+		else
+		{
+			/* Parsed on its own, the tag has to close itself. */
+			tag = inScanner.GetTag();
+			if (token == NTreeXMLScanner::kStartTag)
+			{
+				tag.insert(tag.size() - 1, 1, '/');
+			}
+
+			if ((fXMLTagDocument->Parse(tag.c_str(), tag.size()) != XML_NO_ERROR) || (fXMLTagDocument->RootElement() == nullptr))
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+
+			if (inNodeReanimateXMLFunc != nullptr)
+			{
+				node = (*inNodeReanimateXMLFunc)(fXMLTagDocument->RootElement());
+			}
+			else
+			{
+				node = fXMLTypes.Reanimate(fXMLTagDocument->RootElement());
+				if ((node != nullptr) && (node->ReadXMLAttributes(fXMLTagDocument->RootElement()) != 0))
+				{
+					DeleteNode(node);
+					node = nullptr;
+				}
+			}
+			if (node == nullptr)
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+
+			error = parents.back()->InsertChild(node);
+			if (error != 0)
+			{
+				DeleteNode(node);
+				goto ErrorExit;
+			}
+		}
+
+		if (token == NTreeXMLScanner::kStartTag)
+		{
+			parents.push_back(node);
+			names.push_back(inScanner.GetName());
+		}
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	WriteXML
+
+	Writes the tree to inFilename as XML, one element per node, root first.
+	A node's element is named for its type's four characters ('LETR' is
+	<LETR>), or is <node> with a type attribute if they don't make a name.
+	The names come from the tree's NTreeXMLTypeTable, which keeps them for
+	the printer, and are looked up there once per type.  Its attributes come
+	from the node's WriteXMLAttributes.
+
+	The elements are printed straight to the file as the tree is traversed,
+	opened on entry and closed on exit, through a kXMLBufferSize buffer.
+	Nothing but the open elements' names is kept, so the memory used follows
+	the depth of the tree, not its size.  The XML is compact, without
+	indenting, so deep trees don't fill the file with spaces.
+
+	On exit ioOffset is moved ahead by the size of the file.  inVersion and
+	inWriteCB are not used; the file is written with the C library.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long
+NTree::WriteXML
+(
+	const char* inFilename,
+	long& ioOffset,
+	long inVersion,
+	NTreeNodeWriteCB inWriteCB
+)
+{
+	NTreeReadLock
+		lock(this);
+	long
+		error = 0;
+	FILE*
+		file = nullptr;
+	std::vector<char>
+		buffer(kXMLBufferSize);
+	std::unordered_map<NTreeNodeType, const char*>
+		names;
+	long
+		size = 0;
+
+#ifdef _WIN32
+	if (fopen_s(&file, inFilename, "wb") != 0)
+	{
+		file = nullptr;
+	}
+#else
+	file = fopen(inFilename, "wb");
+#endif
+	if (file == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	if (setvbuf(file, buffer.data(), _IOFBF, buffer.size()) != 0)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	{
+		/* The printer keeps pointers to the open elements' names, which live in fXMLTypes. */
+		XMLPrinter
+			printer(file, true);
+
+		printer.PushHeader(false, true);
+
+		if (VisitAllNTreeNodes(fRoot,
+			[this, &printer, &names](NTreeNodePtr inNode)
+			{
+				const char*&
+					name = names[inNode->GetType()];
+
+				if (name == nullptr)
+				{
+					name = fXMLTypes.GetTagName(inNode->GetType());
+				}
+
+				printer.OpenElement(name, true);
+				if (strcmp(name, "node") == 0)
+				{
+					printer.PushAttribute("type", unsigned(inNode->GetType()));
+				}
+				return (inNode->WriteXMLAttributes(printer) != 0);
+			},
+			[&printer](NTreeNodePtr)
+			{
+				printer.CloseElement(true);
+				return false;
+			},
+			kEntireTree))
+		{
+			error = -1;
+		}
+	}
+
+	fflush(file);
+	size = ftell(file);
+	if ((size < 0) || ferror(file))
+	{
+		error = -1;
+	}
+
+ErrorExit:
+	if (file != nullptr)
+	{
+		if (fclose(file) != 0)
+		{
+			error = -1;
+		}
+	}
+
+	if (error == 0)
+	{
+		ioOffset += size;
+	}
+
+	return ((error == 0) ? false : true);
+}
+
+
+// --------------------------------------------------------------------------------
+/*
+	* Freeze
+
+	Fills outFrozen with a read-only copy of the whole tree, root first.
+	inTagFunc, if not nullptr, gives the tag stored with each node.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTree::Freeze(NTreeFrozen& outFrozen, NTreeNodeFreezeTagFunc inTagFunc)
+{
+	NTreeReadLock
+		lock(this);
+
+	return outFrozen.Build(fRoot, inTagFunc);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* SetThreadSafe
+
+	Makes the tree safe, or not, for many threads to read while one changes it
+	(see NTreeLock.h).  Call it while no other thread is using the tree.  A
+	paged tree is read in whole first, as paging can't be shared.
+
+	Returns true if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+long NTree::SetThreadSafe(bool inThreadSafe)
+{
+	if (inThreadSafe && IsPaged() && (PageInAll() != 0))
+	{
+		return true;
+	}
+
+	fThreadSafe = inThreadSafe;
+
+	return false;
+}
+
+// --------------------------------------------------------------------------------
 /*
 	* FindNodeByID
+
+	Constant time lookup in the tree's ID table.  Returns nullptr if no node in the
+	tree has the ID.  kUnassignedID is never found.
+
+	On a thread-safe tree, hold an NTreeReadLock for as long as the node is used.
 */
 // --------------------------------------------------------------------------------
 NTreeNodePtr NTree::FindNodeByID(NTreeNodeID inID)
 {
-	NodeIDSearchInfo
-		info;
+	NTreeReadLock
+		lock(this);
+
+	if ((fRoot != nullptr) && (fRoot->GetID() == inID))
+	{
+		return fRoot;
+	}
+
+	return (inID < fNodesByID.size()) ? fNodesByID[inID] : nullptr;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* AttachNodes
+
+	inNode has just been put under a node of this tree.  Points it and all of its
+	descendants at the tree and adds them to the ID table.
+*/
+// --------------------------------------------------------------------------------
+void NTree::AttachNodes(NTreeNodePtr inNode)
+{
+	VisitAllNTreeNodes(inNode,
+		[this](NTreeNodePtr inVisited)
+		{
+			bool
+				joining = (inVisited->GetTree() != this);
+
+			inVisited->SetTree(this);
+			IndexNode(inVisited);
+			if (joining)
+			{
+				inVisited->MarkDirty();
+			}
+			return kNTreeVisitContinue;
+		},
+		kActionOnEntry, kJustThisBranch);
+}
 
-	info.id = inID;
-	info.foundNode = nullptr;
+// --------------------------------------------------------------------------------
+/*
+	* DetachNodes
 
-	VisitAllNTreeNodes(fRoot, NTreeNodeActionFunc(SearchForNodeID_ActionFunc), &info, true, false);
+	inNode has just been taken out of this tree.  Removes it and all of its
+	descendants from the ID table and clears their tree.
+*/
+// --------------------------------------------------------------------------------
+void NTree::DetachNodes(NTreeNodePtr inNode)
+{
+	ForgetPage(inNode);
 
-	return (info.foundNode);
+	VisitAllNTreeNodes(inNode,
+		[this](NTreeNodePtr inVisited)
+		{
+			UnindexNode(inVisited, inVisited->GetID());
+			inVisited->SetTree(nullptr);
+			inVisited->MarkClean();
+			return kNTreeVisitContinue;
+		},
+		kActionOnEntry, kJustThisBranch);
 }
 
 // --------------------------------------------------------------------------------
 /*
-	* SearchForNodeID_ActionFunc
+	* NodeIDChanged
+
+	A node of this tree has a new ID.  Moves its ID table entry.
 */
 // --------------------------------------------------------------------------------
-bool
-NTree::SearchForNodeID_ActionFunc
-(
-	NTreeNodePtr
-	inNode,
-	NTree::NodeIDSearchInfo*
-	info
-)
+void NTree::NodeIDChanged(NTreeNodePtr inNode, NTreeNodeID inOldID)
 {
-	if (inNode->GetID() == info->id)
+	UnindexNode(inNode, inOldID);
+	IndexNode(inNode);
+
+	/* The change list is by ID. */
+	if (fTrackingChanges && inNode->IsDirty())
 	{
-		info->foundNode = inNode;
-		return true;
+		fDirtyNodeIDs.push_back(inNode->GetID());
 	}
-
-	return false;
 }
 
-#if 1
 // --------------------------------------------------------------------------------
 /*
-	* VisitAllNTreeNodes (re-entrant up to 32 times)
+	* NodeChanged
 
-	You may start the visitation on any node in the tree.
-	Returns true if an action proc aborted (an error occured).
+	A node of this tree has just been marked dirty.  Adds it to the nodes the
+	next WriteDelta writes.
 */
 // --------------------------------------------------------------------------------
-bool NTree::VisitAllNTreeNodes
-(
-	NTreeNodePtr inStartNode,                     // NTreeNodePtr to start on.
-	NTreeNodeActionFunc inNodeActionProc,         // Action procedure to perform at every node.
-	void* inNodeActionParm,                       // Parameter to be passed to action procedure.
-	bool inActionOnEntry,                         // If true, action procedure is called BEFORE any child is visited,
-												  //  (i.e. when the node is first encountered).
-												  // If false, the action procedure is executed AFTER all children,
-												  //	(i.e. before the node moves up to parent).
-	bool inDoOnlyThisBranch                       // If false, the search begins at inStartNode and visits the entire tree.
-												  // If true, only inStartNode and descendents of inStartNode are visited.
-
-)
+void NTree::NodeChanged(NTreeNodePtr inNode)
 {
-	NTreeNodePtr
-		node = inStartNode;
-	short
-		flags;
-	bool
-		abort = false;
-	bool
-		endOfBranchCausedAbort = false;
-	NTreeNodePtr
-		parent = nullptr;
-	bool
-		nodeIsStartNode = false;
-	static short
-		entryCount = 0; // Number of times this routine has been entered.
-
-
-	  /* Update our entry count. */
-	entryCount += 1;
-	if (entryCount > kMaxRecursion)
+	if (fTrackingChanges)
 	{
-		goto Exit;
+		fDirtyNodeIDs.push_back(inNode->GetID());
 	}
+}
 
-	/* The NTree has one set of bits available at all times.  If we enter this recursively,
-		we need to create more.  Else, we simply clear the bit array. */
-	if (entryCount > 1)
-	{
-		PushVisitedBits();
-	}
-	else
-	{
-		ClearVisitedBits();
-	}
+// --------------------------------------------------------------------------------
+/*
+	* DeleteNode
+
+	Destroys a node that is no longer in the tree.  Nodes from CreateNode()
+	go back to the arena they came from; any others are deleted.
+*/
+// --------------------------------------------------------------------------------
+void NTree::DeleteNode(NTreeNodePtr inNode)
+{
+	NTreeNodeArenaPtr
+		arena = nullptr;
+	void*
+		memory = nullptr;
 
-	// Loop until node == nullptr, this means we have visited all nodes.
-	while (node != nullptr)
+	if (inNode != nullptr)
 	{
-		flags = node->GetFlags();
+		arena = inNode->GetArena();
 
-		// Has this node been visited?
-		if (Visited(node->GetID()) == true)
+		if (arena == nullptr)
 		{
-			// We do this just in case the action function wants to dispose of the node.
-			parent = node->GetParent();
-			nodeIsStartNode = (node == inStartNode) ? true : false;
-
-			// If the caller wants an action on exit, do it now.
-			if (!inActionOnEntry)
-			{
-				if (inNodeActionProc != nullptr)
-				{
-					abort = (*inNodeActionProc)(node, inNodeActionParm);
-					if (abort == true)
-					{
-						goto Exit;
-					}
-					// node is possibly invalid here.
-				}
-			}
-
-			// If we're about to move up to a new parent, check to see if the node we are at
-			//  is the node we started with.  If this is the case and inDoOnlyThisBranch
-			//  is true, then we are done processing - abort (don't do any more actions).
-			if (nodeIsStartNode && inDoOnlyThisBranch)
-			{
-				abort = true;
-				endOfBranchCausedAbort = true;
-				goto Exit;
-			}
-
-			// Move up to parent.
-			node = parent;
+			delete inNode;
 		}
 		else
 		{
-			bool
-				found = false;
-			NTreeNodePtr
-				child = nullptr;
-			bool
-				didAction = false;
-			short
-				numChildren = node->GetNumChildren();
-			short
-				childIndex = numChildren - 1;
-
-
-			// If we don't have any children, this could be because a) this node REALLY
-			//  doesn't have any children (its a 'leaf') or b) we're possibly in the
-			//  middle of some creation routine that plans to add children as part of
-			//  its action proc.
-			if (numChildren == 0)
-			{
-				if (inActionOnEntry)
-				{
-					if (inNodeActionProc != nullptr)
-					{
-						abort = (*inNodeActionProc)(node, inNodeActionParm);
-						if (abort == true)
-						{
-							goto Exit;
-						}
-
-						// We did an action routine.  Make sure it doesn't get called again.
-						didAction = true;
-
-						// The action proc may have added children, update our count.
-						numChildren = node->GetNumChildren();
-					}
-				}
-			}
-
-			// Find first unvisited child, and visit (if we are not steering)
-			{
-				// Search backward for any children that might have been visited.  Use this as the starting point to find
-				// the first unvisited child.
-				while ((childIndex >= 0) && !found)
-				{
-					child = node->GetChild(childIndex);
-
-					if (Visited(child->GetID()) == true)
-					{
-						found = true;
-					}
-					else
-					{
-						childIndex -= 1;
-					}
-				}
+			/* The block starts at the most derived object, not necessarily at the NTreeNode. */
+			memory = dynamic_cast<void*>(inNode);
+			inNode->~NTreeNode();
+			arena->Free(memory);
+		}
+	}
+}
 
-				// If we found one, increment the index.  This is start point for finding the first unvisited child.
-				if (found == true)
-				{
-					childIndex += 1;
-					if (childIndex >= numChildren)
-					{
-						childIndex = 0;
-					}
-				}
-				else
-				{
-					childIndex = 0;
-				}
+// --------------------------------------------------------------------------------
+/*
+	* NewNodeID
 
-				found = false;
-				while ((childIndex < numChildren) && !found)
-				{
-					child = node->GetChild(childIndex);
-
-					if (Visited(child->GetID()) == false)
-					{
-						found = true;
-					}
-					else
-					{
-						childIndex += 1;
-					}
-				}
+	Returns an ID that no node in the tree is using, for a node about to be
+	created.  IDs given back by pruned nodes are reused first, which keeps the
+	IDs in use dense and the ID table small.  Returns kUnassignedID if the tree
+	has run out of IDs.
+*/
+// --------------------------------------------------------------------------------
+NTreeNodeID NTree::NewNodeID(void)
+{
+	NTreeNodeID
+		id = NTreeNode::kUnassignedID;
 
-				// If we have found at least one child and we are about to drop to the first child,
-				//  then check for action on entry.  Do this only if we haven't called an action proc yet.
-				if (found && (childIndex == 0) && !didAction)
-				{
-					if (inActionOnEntry)
-					{
-						if (inNodeActionProc != nullptr)
-						{
-							abort = (*inNodeActionProc)(node, inNodeActionParm);
-							if (abort == true)
-							{
-								goto Exit;
-							}
-						}
-					}
-				}
-			}
+	while (!fFreeNodeIDs.empty())
+	{
+		id = fFreeNodeIDs.back();
+		fFreeNodeIDs.pop_back();
 
-			// Did we find one? 
-			if (found == true)
-			{
-				// Yes, go visit.
-				node = child;
-			}
-			else
-			{
-				SetVisitedBit(node->GetID(), true);
-			}
+		if (!IsNodeIDInUse(id))
+		{
+			return id;
 		}
 	}
 
-Exit:
-
-	/* Decrement the instance counter.  This lets us know we have finished a traversal and we're leaving. */
-	if (entryCount > 0)
+	while (fNextNodeID < NTreeNodeRoot::kID)
 	{
-		if (entryCount > 1)
+		id = NTreeNodeID(fNextNodeID);
+		fNextNodeID += 1;
+
+		if (!IsNodeIDInUse(id))
 		{
-			PopVisitedBits();
+			return id;
 		}
-		entryCount -= 1;
 	}
 
-	/* Return true only if we did not abort due to an end of of branch */
-	return (abort == true ? (endOfBranchCausedAbort == true ? false : true) : false);
+	return NTreeNode::kUnassignedID;
 }
-#endif
 
 // --------------------------------------------------------------------------------
 /*
-	* FindRoot
+	* ReleaseNodeID
 
-	Given any NTreeNode, this routine finds the NTree root.  In the event that the
-	node is not attached to any tree, this routine returns nullptr.
+	Gives an ID back to the tree once the node that had it has been deleted.
+	While the tree tracks changes, the ID isn't handed out again until the next
+	save, so that no delta has two nodes with the same ID.
 */
 // --------------------------------------------------------------------------------
-
-NTreeNodePtr
-NTree::FindRoot(NTreeNodePtr inStartNode)
+void NTree::ReleaseNodeID(NTreeNodeID inID)
 {
-	NTreeNodePtr
-		node = inStartNode;
-
-	if (node != nullptr)
+	if ((inID != NTreeNode::kUnassignedID) && (inID < fNextNodeID) && !IsNodeIDInUse(inID))
 	{
-		while (node->GetParent() != nullptr)
+		if (fTrackingChanges)
 		{
-			node = node->GetParent();
+			fHeldNodeIDs.push_back(inID);
+		}
+		else
+		{
+			fFreeNodeIDs.push_back(inID);
 		}
 	}
-
-	return (node->GetType() == NTreeNodeRoot::kType) ? node : nullptr;
 }
 
 // --------------------------------------------------------------------------------
 /*
-	* GetTreeFromNode
-
-	Given any NTreeNode, this routine finds the NTree root and returns a pointer
-	to the tree.
+	* IsNodeIDInUse
 */
 // --------------------------------------------------------------------------------
-NTreePtr
-NTree::GetTreeFromNode(NTreeNodePtr inStartNode)
+bool NTree::IsNodeIDInUse(NTreeNodeID inID) const
 {
-	NTreeNodePtr
-		node = FindRoot(inStartNode);
-
-	return (node != nullptr) ? static_cast<NTreeNodeRoot*>(node)->GetTree() : nullptr;
+	return (inID < fNodesByID.size()) && (fNodesByID[inID] != nullptr);
 }
 
 // --------------------------------------------------------------------------------
 /*
+	* IndexNode
+
+	Adds inNode to the ID table.  IDs that came from somewhere other than
+	NewNodeID (a file, say) move the allocator past them.
 */
 // --------------------------------------------------------------------------------
-long
-NTree::PushVisitedBits(void)
+void NTree::IndexNode(NTreeNodePtr inNode)
 {
-	long
-		error = 0;
-	VisitedBitsPtr
-		newVB = nullptr;
+	NTreeNodeID
+		id = inNode->GetID();
 
+	if ((inNode == fRoot) || (id == NTreeNode::kUnassignedID) || (id == NTreeNodeRoot::kID))
+	{
+		return;
+	}
 
-	newVB = VisitedBitsPtr(malloc(sizeof(VisitedBits)));
-	if (newVB == nullptr)
+	if (id >= fNextNodeID)
 	{
-		error = -1;
-		goto ErrorExit;
+		fNextNodeID = id + 1;
+	}
+
+	if (id >= fNodesByID.size())
+	{
+		fNodesByID.resize(size_t(id) + 1, nullptr);
 	}
 
-	newVB->next = nullptr;
+	fNodesByID[id] = inNode;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* UnindexNode
 
-	newVB->bits = static_cast<char*>(malloc(kNumVisitedBytes));
-	if (newVB->bits == nullptr)
+	Clears the ID table entry for inID, if it still refers to inNode.
+*/
+// --------------------------------------------------------------------------------
+void NTree::UnindexNode(NTreeNodePtr inNode, NTreeNodeID inID)
+{
+	if ((inID < fNodesByID.size()) && (fNodesByID[inID] == inNode))
 	{
-		error = -1;
-		goto ErrorExit;
+		fNodesByID[inID] = nullptr;
 	}
+}
 
-	newVB->next = fVisitedBits;
-	fVisitedBits = newVB;
+// --------------------------------------------------------------------------------
+/*
+	* VisitAllNTreeNodes
+
+	You may start the visitation on any node in the tree.
+	Returns true if an action proc aborted (an error occured).
 
-	ClearVisitedBits();
+	The traversal state lives in a context taken from the calling thread's pool, so
+	this is re-entrant (an action proc may start another traversal) and several
+	threads may traverse at once.  See NTreeVisitNodes in NTreeTraversal.h.
+*/
+// --------------------------------------------------------------------------------
+bool NTree::VisitAllNTreeNodes
+(
+	NTreeNodePtr inStartNode,
+	NTreeNodeActionFunc inNodeActionProc,
+	void* inNodeActionParm,
+	bool inActionOnEntry,
+	bool inDoOnlyThisBranch
+)
+{
+	NTreeTraversalContextHolder
+		context;
 
-ErrorExit:
-	return error;
+	return VisitAllNTreeNodes(*context, inStartNode, inNodeActionProc, inNodeActionParm, inActionOnEntry, inDoOnlyThisBranch);
 }
 
 // --------------------------------------------------------------------------------
 /*
+	* VisitAllNTreeNodes
+
+	You may start the visitation on any node in the tree.
+	Returns true if an action proc aborted (an error occured).
+
+	The traversal stack is kept in ioContext, which must not be in use by another
+	traversal.  See NTreeVisitNodes in NTreeTraversal.h.
 */
 // --------------------------------------------------------------------------------
-long
-NTree::PopVisitedBits(void)
+bool NTree::VisitAllNTreeNodes
+(
+	NTreeTraversalContext& ioContext,             // Holds the traversal stack.
+	NTreeNodePtr inStartNode,                     // NTreeNodePtr to start on.
+	NTreeNodeActionFunc inNodeActionProc,         // Action procedure to perform at every node.
+	void* inNodeActionParm,                       // Parameter to be passed to action procedure.
+	bool inActionOnEntry,                         // If true, action procedure is called BEFORE any child is visited,
+												  //  (i.e. when the node is first encountered).
+												  // If false, the action procedure is executed AFTER all children,
+												  //	(i.e. before the node moves up to parent).
+	bool inDoOnlyThisBranch                       // If false, the search begins at inStartNode and visits the entire tree.
+												  // If true, only inStartNode and descendents of inStartNode are visited.
+
+)
 {
-	long
-		error = 0;
+	return VisitWithFunc(ioContext, inStartNode, inNodeActionProc, inNodeActionParm, inActionOnEntry, inDoOnlyThisBranch);
+}
 
-	if (fVisitedBits != nullptr)
-	{
-		VisitedBitsPtr
-			vb = fVisitedBits;
+// --------------------------------------------------------------------------------
+/*
+	* VisitAllNTreeNodes
 
-		fVisitedBits = fVisitedBits->next;
-		free(vb->bits);
-		free(vb);
-	}
+	Same as above, but the action procedure returns an NTreeVisitResult so it can
+	skip children, skip siblings or stop.
+*/
+// --------------------------------------------------------------------------------
+bool NTree::VisitAllNTreeNodes
+(
+	NTreeNodePtr inStartNode,
+	NTreeNodeVisitFunc inNodeVisitProc,
+	void* inNodeActionParm,
+	bool inActionOnEntry,
+	bool inDoOnlyThisBranch
+)
+{
+	NTreeTraversalContextHolder
+		context;
 
-	return error;
+	return VisitWithFunc(*context, inStartNode, inNodeVisitProc, inNodeActionParm, inActionOnEntry, inDoOnlyThisBranch);
 }
 
 // --------------------------------------------------------------------------------
 /*
+	* VisitAllNTreeNodes
 */
 // --------------------------------------------------------------------------------
-long
-NTree::ClearVisitedBits(void) const
+bool NTree::VisitAllNTreeNodes
+(
+	NTreeTraversalContext& ioContext,
+	NTreeNodePtr inStartNode,
+	NTreeNodeVisitFunc inNodeVisitProc,
+	void* inNodeActionParm,
+	bool inActionOnEntry,
+	bool inDoOnlyThisBranch
+)
 {
-	long
-		error = 0;
+	return VisitWithFunc(ioContext, inStartNode, inNodeVisitProc, inNodeActionParm, inActionOnEntry, inDoOnlyThisBranch);
+}
 
-	if (fVisitedBits != nullptr)
-	{
-		long
-			i;
-		long
-			numLongs = kNumVisitedBytes / sizeof(long);
-		long*
-			lptr = reinterpret_cast<long*>(fVisitedBits->bits);
+// --------------------------------------------------------------------------------
+/*
+	* VisitWithFunc
 
-		for (i = 0; i < numLongs; i += 1)
-		{
-			*(lptr + i) = 0;
-		}
+	Runs NTreeVisitNodes with a function pointer and its parameter as the entry or
+	exit action, holding the start node's tree's lock shared if it is
+	thread-safe.
+*/
+// --------------------------------------------------------------------------------
+template <class Func>
+bool NTree::VisitWithFunc
+(
+	NTreeTraversalContext& ioContext,
+	NTreeNodePtr inStartNode,
+	Func inProc,
+	void* inParm,
+	bool inActionOnEntry,
+	bool inDoOnlyThisBranch
+)
+{
+	NTreeReadLock
+		lock(GetTreeFromNode(inStartNode));
+	NTreeNoAction
+		none;
+	FuncCaller<Func>
+		action;
+
+	if (inProc == nullptr)
+	{
+		return NTreeVisitNodes(ioContext, inStartNode, none, none, inDoOnlyThisBranch);
 	}
 
-	return error;
+	action.proc = inProc;
+	action.parm = inParm;
+
+	return inActionOnEntry ?
+		NTreeVisitNodes(ioContext, inStartNode, action, none, inDoOnlyThisBranch) :
+		NTreeVisitNodes(ioContext, inStartNode, none, action, inDoOnlyThisBranch);
 }
 
 // --------------------------------------------------------------------------------
 /*
+	* FindRoot
+
+	Given any NTreeNode, this routine finds the NTree root.  In the event that the
+	node is not attached to any tree, this routine returns nullptr.
+
+	Nodes in a tree know their tree, so this only walks up the parents of nodes
+	that aren't.
 */
 // --------------------------------------------------------------------------------
-void
-NTree::SetVisitedBit(NTreeNodeID inNodeID, bool inState) const
+
+NTreeNodePtr
+NTree::FindRoot(NTreeNodePtr inStartNode)
 {
-	long
-		byteNum = static_cast<unsigned long>(inNodeID) / 8;
-	short
-		bitNum = static_cast<short>(static_cast<short>(inNodeID) - static_cast<short>(byteNum * 8));
-	char
-		mask = 1 << (7 - bitNum);
-	char*
-		vb = fVisitedBits->bits;
+	NTreeNodePtr
+		node = inStartNode;
 
-	if (inState == true)
+	if (node == nullptr)
 	{
-		*(vb + byteNum) |= mask;
+		return nullptr;
 	}
-	else
+
+	if (node->GetTree() != nullptr)
+	{
+		return node->GetTree()->GetRoot();
+	}
+
+	while (node->GetParent() != nullptr)
 	{
-		*(vb + byteNum) &= ~mask;
+		node = node->GetParent();
 	}
+
+	return (node->GetType() == NTreeNodeRoot::kType) ? node : nullptr;
 }
 
 // --------------------------------------------------------------------------------
 /*
+	* GetTreeFromNode
+
+	Given any NTreeNode, this routine returns a pointer to the tree it is in.
 */
 // --------------------------------------------------------------------------------
-bool
-NTree::Visited(NTreeNodeID inNodeID) const
+NTreePtr
+NTree::GetTreeFromNode(NTreeNodePtr inStartNode)
 {
-	long
-		byteNum = static_cast<unsigned long>(inNodeID) / 8;
-	short
-		bitNum = static_cast<short>(static_cast<short>(inNodeID) - static_cast<short>(byteNum * 8));
-	char
-		mask = 1 << (7 - bitNum);
-	char*
-		vb = fVisitedBits->bits;
-
-	return (*(vb + byteNum) & mask) != 0 ? true : false;
+	return (inStartNode != nullptr) ? inStartNode->GetTree() : nullptr;
 }
 
 // --------------------------------------------------------------------------------
@@ -874,7 +3162,9 @@ NTree::IsRoot(NTreeNodePtr inNode)
 /*
 	Prune
 
-	Recursively deletes nodes starting from inStartNode
+	Deletes inStartNode and everything under it, in time proportional to the
+	size of the branch.  The root, or a node with no parent, is kept and only
+	loses its children.
 
 	Returns true if an error occurred.
 */
@@ -882,7 +3172,51 @@ NTree::IsRoot(NTreeNodePtr inNode)
 bool
 NTree::Prune(NTreeNodePtr inStartNode)
 {
-	return VisitAllNTreeNodes(inStartNode, NTreeNodeActionFunc(DisposeNTree_ActionFunc), this, kActionOnExit, kJustThisBranch);
+	NTreeWriteLock
+		lock(this);
+	long
+		error = 0;
+	NTreeNodePtr
+		parent = inStartNode->GetParent();
+	NTreeChildIndex
+		i;
+
+	if (lock.GetError() != 0)
+	{
+		return true;
+	}
+
+	if (IsRoot(inStartNode) || (parent == nullptr))
+	{
+		/* Branches still in the file are empty nodes, and go like the rest. */
+		if (inStartNode == fRoot)
+		{
+			StopPaging();
+		}
+
+		/* The start node stays; its children go. */
+		for (i = 0; i < inStartNode->GetNumChildren(); i += 1)
+		{
+			DetachNodes(inStartNode->GetChild(i));
+			DisposeBranch(inStartNode->GetChild(i), kDisposeReleasingIDs);
+		}
+		if (inStartNode->GetNumChildren() > 0)
+		{
+			inStartNode->SetNumChildren(0);
+			inStartNode->MarkDirty();
+		}
+	}
+	else
+	{
+		/* One removal detaches the whole branch from the parent and the ID table. */
+		error = parent->RemoveChild(inStartNode);
+		if (error == 0)
+		{
+			DisposeBranch(inStartNode, kDisposeReleasingIDs);
+		}
+	}
+
+	return (error == 0) ? false : true;
 }
 
 
@@ -937,7 +3271,7 @@ bool NTree::DumpNode_ActionFunc
 
 	/* Node ID */
 	NTreeNodeID id = inNode->GetID();
-	_RPT1(_CRT_WARN, "%d", id);
+	_RPT1(_CRT_WARN, "%u", unsigned(id));
 
 	_RPT0(_CRT_WARN, " ");
 
@@ -948,8 +3282,8 @@ bool NTree::DumpNode_ActionFunc
 	_RPT0(_CRT_WARN, " ");
 
 	/* Number of Children */
-	short numberOfChildren = inNode->GetNumChildren();
-	_RPT1(_CRT_WARN, "%d", numberOfChildren);
+	NTreeChildIndex numberOfChildren = inNode->GetNumChildren();
+	_RPT1(_CRT_WARN, "%d", int(numberOfChildren));
 
 	_RPT0(_CRT_WARN, "\n");
 
@@ -1006,7 +3340,7 @@ NTree::DumpNode_ActionFunc
 
 	/* Node ID */
 	NTreeNodeID id = inNode->GetID();
-	std::cout << int(id);
+	std::cout << (unsigned long)(id);
 
 	std::cout << char(' ');
 
@@ -1017,8 +3351,8 @@ NTree::DumpNode_ActionFunc
 	std::cout << char(' ');
 
 	/* Number of Children */
-	short numberOfChildren = inNode->GetNumChildren();
-	std::cout << short(numberOfChildren);
+	NTreeChildIndex numberOfChildren = inNode->GetNumChildren();
+	std::cout << long(numberOfChildren);
 
 	std::cout << char('\n');
 
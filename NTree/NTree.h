@@ -31,32 +31,44 @@
 
 		VisitAllNTreeNodes is the heart of the NTree system.  It handles the depth
 		first search of each node in the tree.  See that function for more information.
+
+		Nodes may be made with new, or with CreateNode<T>() which builds them in
+		slabs owned by the tree (see NTreeNodeArena.h).
+
+		After SetThreadSafe(true), many threads may read the tree while one
+		changes it (see NTreeLock.h).
 */
 // --------------------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "NTreeCompact.h"
+#include "NTreeFrozen.h"
+#include "NTreeLock.h"
 #include "NTreeNode.h"
+#include "NTreeNodeArena.h"
+#include "NTreeTraversal.h"
+#include "NTreeXMLTypes.h"
 
 #ifndef NULL
 #define NULL 0
 #endif
 
 namespace tinyxml2 {
+	class XMLDocument;
 	class XMLElement;
+	class XMLPrinter;
 }
 
-// --------------------------------------------------------------------------------
-/*
-	The limiting factor in the recursion depth of the VisitAllNTreeNodes function is the
-	number of bits available to save "visited" state for each node.  This is currently
-	implemented using 1 bit in an unsigned long (32 bits total) so therefore the max
-	number of times VisitAllNTreeNodes() can be entered is 32.
-*/
-// --------------------------------------------------------------------------------
-const short kMaxRecursion = 32;
+class NTreeXMLScanner;
 
 typedef bool (*NTreeNodeActionFunc)(NTreeNodePtr, void*);
-
-class NTree;
-typedef class NTree* NTreePtr;
+typedef NTreeVisitResult (*NTreeNodeVisitFunc)(NTreeNodePtr, void*);
 
 class NTreeNodeRoot : public NTreeNode
 {
@@ -64,20 +76,46 @@ public:
 
 	enum
 	{
-		kType = 'ROOT',
-		kID = 0xFFFF
+		kType = 'ROOT'
 	};
 
+	static const NTreeNodeID kID = kNTreeMaxNodeID;
+
 	NTreeNodeRoot(void);
 	NTreeNodeRoot(NTreePtr);
 	virtual ~NTreeNodeRoot();
 
-	NTreePtr GetTree(void) const;
-	void SetTree(NTreePtr);
+	/* Pages the child in first when the tree is paged (see NTree::OpenPaged). */
+	virtual NTreeNodePtr GetChild(NTreeChildIndex);
+
+	virtual NTreeNodePtr CloneForWrite(long);
+};
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeRecordCopy
+
+	What NTreeNode::CloneForWrite makes of a node whose class it doesn't know:
+	the node's record, written into memory when the copy is made, and written
+	out again as it is.  Base is NTreeNode, or NTreeNodeRoot for the root.
+*/
+// --------------------------------------------------------------------------------
+template <class Base>
+class NTreeRecordCopy : public Base
+{
+public:
+
+	NTreeRecordCopy(void) { fVersion = 0; }
+
+	long Capture(NTreeNodePtr, long);
+	virtual long Write(void*, long&, long, NTreeNodeWriteCB);
 
 private:
 
-	NTreePtr fTree;
+	static long CaptureCB(void*, void*, unsigned long, unsigned long, long);
+
+	std::vector<unsigned char> fRecord;		// the record, as the node's Write wrote it
+	long fVersion;							// the version it was written with
 };
 
 
@@ -91,7 +129,9 @@ public:
 		kActionOnExit = false,
 		kJustThisBranch = true,
 		kEntireTree = false,
-		kNumVisitedBytes = 8192
+		kIndexMagic = 'NTOC',
+		kDeltaMagic = 'NTDL',
+		kXMLBufferSize = 1024 * 1024
 	};
 
 	struct TreeWriteInfo
@@ -101,6 +141,7 @@ public:
 		long version;
 		NTreeNodePtr root;
 		NTreeNodeWriteCB writeCB;
+		const NTreeTypeDictionary* types;	// from version 7, nullptr before
 	};
 	typedef struct TreeWriteInfo TreeWriteInfo;
 
@@ -119,6 +160,38 @@ public:
 	};
 	typedef struct TreeReadInfo TreeReadInfo;
 
+	/* The table of contents WriteIndexed puts in front of the tree: this header, then
+		one entry per child of the root.  Offsets are from the start of the tree. */
+	struct TreeIndexHeader
+	{
+		uint32_t magic;			// kIndexMagic
+		uint32_t version;		// version the tree was written with
+		uint32_t numEntries;
+		uint32_t maxNodeID;		// largest node ID in the tree, not counting the root's
+		int64_t treeSize;		// bytes in the tree that follows the table
+	};
+	typedef struct TreeIndexHeader TreeIndexHeader;
+
+	struct TreeIndexEntry
+	{
+		int64_t offset;			// where the branch's first node starts
+		int64_t numNodes;		// nodes in the branch
+	};
+	typedef struct TreeIndexEntry TreeIndexEntry;
+
+	/* Each delta WriteDelta appends starts with this header, followed by one record per
+		changed node: its ID (0xFFFFFFFF for the root), the node as Write writes it, then
+		the IDs of its children, all IDs as 32 bits. */
+	struct TreeDeltaHeader
+	{
+		uint32_t magic;			// kDeltaMagic
+		uint32_t version;		// version the nodes were written with
+		uint32_t numRecords;
+		uint32_t reserved;
+		int64_t deltaSize;		// bytes in the records that follow the header
+	};
+	typedef struct TreeDeltaHeader TreeDeltaHeader;
+
 	NTree(void);
 	NTree(NTreeNodeRoot*);
 	virtual ~NTree();
@@ -128,17 +201,72 @@ public:
 	virtual long Read(void*, long&, long, NTreeNodeReanimateFunc, NTreeNodeReadCB);
 	virtual long Write(void*, long&, long, NTreeNodeWriteCB);
 
+	/* Binary trees with a table of contents, for loading branches in parallel. */
+	virtual long WriteIndexed(void*, long&, long, NTreeNodeWriteCB);
+	virtual long ReadIndexed(void*, long&, long, NTreeNodeReanimateFunc, NTreeNodeReadCB, unsigned int = 0);
+	virtual long ReadIndex(void*, long, NTreeNodeReadCB, TreeIndexHeader&, std::vector<TreeIndexEntry>&);
+
+	/* Saving on a worker thread, from a copy of the tree made on the calling thread. */
+	virtual std::future<long> WriteAsync(void*, long, long, NTreeNodeWriteCB, bool = false);
+
+	/* Paging: the branches under the root are read from an indexed file when first reached. */
+	virtual long OpenPaged(void*, long, long, NTreeNodeReanimateFunc, NTreeNodeReadCB, long = 0);
+	virtual long PageIn(NTreeNodePtr);
+	virtual long PageOut(NTreeNodePtr);
+	virtual long PageInAll(void);
+	bool IsPaged(void) const { return fPageInfo != nullptr; }
+	long GetNumPagedInNodes(void) const;
+
+	/* Delta saves: only the nodes changed since the last save, appended to a delta file. */
+	virtual long WriteDelta(void*, long&, long, NTreeNodeWriteCB);
+	virtual long ReadDeltas(void*, long&, NTreeNodeReanimateFunc, NTreeNodeReadCB);
+	bool IsTrackingChanges(void) const { return fTrackingChanges; }
+
 	virtual long ReadXML(const char*, long&, long, NTreeNodeReanimateXMLFunc, NTreeNodeReadCB);
+	virtual long ReadXML(const char*, size_t, NTreeNodeReanimateXMLFunc);
 	virtual long WriteXML(const char*, long&, long, NTreeNodeWriteCB);
+	NTreeXMLTypeTable& GetXMLTypes(void) { return fXMLTypes; }
 
 	virtual NTreeNodePtr FindNodeByID(NTreeNodeID);
 
+	/* Threads: many readers, or one writer, at a time (see NTreeLock.h). */
+	virtual long SetThreadSafe(bool);
+	bool IsThreadSafe(void) const { return fThreadSafe; }
+	NTreeLock& GetLock(void) { return fLock; }
+
+	/* Read-only flat copy for fast reading (see NTreeFrozen.h). */
+	virtual long Freeze(NTreeFrozen&, NTreeNodeFreezeTagFunc = nullptr);
+
+	/* Nodes */
+	template <class T, class... Args>
+	T* CreateNode(Args&&...);
+	virtual void DeleteNode(NTreeNodePtr);
+
+	/* Node IDs */
+	virtual NTreeNodeID NewNodeID(void);
+	virtual void ReleaseNodeID(NTreeNodeID);
+
+	/* Called by NTreeNode to keep the ID table current. */
+	void AttachNodes(NTreeNodePtr);
+	void DetachNodes(NTreeNodePtr);
+	void NodeIDChanged(NTreeNodePtr, NTreeNodeID);
+	void NodeChanged(NTreeNodePtr);
+
 	virtual NTreeNodeRoot* GetRoot(void) { return fRoot; }
 
 	static NTreeNodePtr FindRoot(NTreeNodePtr);
 	static NTreePtr GetTreeFromNode(NTreeNodePtr);
 
 	virtual bool VisitAllNTreeNodes(NTreeNodePtr, NTreeNodeActionFunc, void*, bool, bool);
+	virtual bool VisitAllNTreeNodes(NTreeTraversalContext&, NTreeNodePtr, NTreeNodeActionFunc, void*, bool, bool);
+	virtual bool VisitAllNTreeNodes(NTreeNodePtr, NTreeNodeVisitFunc, void*, bool, bool);
+	virtual bool VisitAllNTreeNodes(NTreeTraversalContext&, NTreeNodePtr, NTreeNodeVisitFunc, void*, bool, bool);
+
+	/* Inlinable versions; the actions may be any callable taking an NTreeNodePtr and returning a bool or NTreeVisitResult. */
+	template <class Action>
+	bool VisitAllNTreeNodes(NTreeNodePtr, Action, bool, bool);
+	template <class EntryAction, class ExitAction, class = NTreeActionResultOf(ExitAction)>
+	bool VisitAllNTreeNodes(NTreeNodePtr, EntryAction, ExitAction, bool);
 
 	virtual bool Prune(NTreeNodePtr);
 
@@ -149,46 +277,244 @@ public:
 
 private:
 
-	struct NodeIDSearchInfo
+	template <class Func>
+	struct FuncCaller
 	{
-		NTreeNodeID
-			id;
-		NTreeNodePtr
-			foundNode;
-	};
-	typedef struct NodeIDSearchInfo NodeIDSearchInfo;
+		Func
+			proc;
+		void*
+			parm;
 
-	struct VisitedBits;
-	typedef struct VisitedBits VisitedBits;
-	typedef VisitedBits* VisitedBitsPtr;
-	struct VisitedBits
-	{
-		VisitedBitsPtr
-			next;
-		char*
-			bits;
+		NTreeVisitResult operator()(NTreeNodePtr inNode) const { return NTreeToVisitResult((*proc)(inNode, parm)); }
 	};
 
-	static bool SearchForNodeID_ActionFunc(NTreeNodePtr, NodeIDSearchInfo*);
+	template <class Func>
+	static bool VisitWithFunc(NTreeTraversalContext&, NTreeNodePtr, Func, void*, bool, bool);
+
 	static bool WriteNTreeNode_ActionFunc(NTreeNodePtr, void*);
 	static bool ReadNTreeNode_ActionFunc(NTreeNodePtr, TreeReadInfo*);
-	static bool DisposeNTree_ActionFunc(NTreeNodePtr, void*);
 
-	static long CreateNTreeNodeFromXMLElement(NTreeNode* inParent, TreeReadInfo* inTreeInfo, tinyxml2::XMLElement* inXMLElement);
 	static bool WriteNTreeXMLNode_ActionFunc(NTreeNodePtr, void*);
 	static bool ReadNTreeXMLNode_ActionFunc(NTreeNodePtr, TreeReadInfo*);
 
-	long PushVisitedBits(void);
-	long PopVisitedBits(void);
-	long ClearVisitedBits(void) const;
-	void SetVisitedBit(NTreeNodeID, bool) const;
-	bool Visited(NTreeNodeID) const;
-
 private:
 
+	enum DisposeMode
+	{
+		kDisposeReleasingIDs,	// the nodes' IDs may be handed out again
+		kDisposeKeepingIDs,		// the nodes will be read back in with the same IDs
+		kDisposeTreeGoingAway	// skip the ID table and the arena's free lists
+	};
+
+	struct TreePageInfo;
+	struct TreeAsyncSaves;
+
+	long ReadBranch(NTreeNodePtr, void*, long&, long, NTreeNodeReanimateFunc, NTreeNodeReadCB, const NTreeTypeDictionary*);
+	long ReadCompactBranch(NTreeNodePtr, void*, long&, long, NTreeNodeReanimateFunc, NTreeNodeReadCB, const NTreeTypeDictionary&);
+	long ReadRoot(void*, long&, long, NTreeNodeReanimateFunc, NTreeNodeReadCB, long, const std::vector<TreeIndexEntry>&, const NTreeTypeDictionary*);
+	static long WriteRecord(NTreeNodePtr, void*, long&, long, NTreeNodeWriteCB, const NTreeTypeDictionary*);
+	void StopPaging(void);
+	void ForgetPage(NTreeNodePtr);
+	long ReadDelta(void*, long&, const TreeDeltaHeader&, NTreeNodeReanimateFunc, NTreeNodeReadCB);
+	long ReadXMLElements(NTreeXMLScanner&, NTreeNodeReanimateXMLFunc);
+	void StartTrackingChanges(std::vector<NTreeNodeID>* = nullptr);
+	void FinishSave(unsigned long);
+	NTreePtr CopyForWrite(long);
+	void FinishAsyncSaves(bool);
+
+	bool IsNodeIDInUse(NTreeNodeID) const;
+	void IndexNode(NTreeNodePtr);
+	void UnindexNode(NTreeNodePtr, NTreeNodeID);
+	void DisposeBranch(NTreeNodePtr, DisposeMode);
+
 	NTreeNodeRoot* fRoot;
-	VisitedBitsPtr fVisitedBits;
+	NTreeNodeArena fArena;					// memory for the nodes made by CreateNode
+	std::vector<NTreeNodePtr> fNodesByID;	// every node in the tree but the root, indexed by ID
+	std::vector<NTreeNodeID> fFreeNodeIDs;	// IDs of deleted nodes, handed out again by NewNodeID
+	std::vector<NTreeNodeID> fHeldNodeIDs;	// IDs of nodes deleted since the last save, free after the next
+	std::vector<NTreeNodeID> fDirtyNodeIDs;	// nodes changed since the last save; may repeat or be gone
+	bool fTrackingChanges;					// the tree was last read or saved whole, so deltas can follow
+	unsigned long fNextNodeID;				// lowest ID never handed out by NewNodeID
+	TreePageInfo* fPageInfo;				// branches still in the file, nullptr unless paged
+	tinyxml2::XMLDocument* fXMLTagDocument;	// parses ReadXML's tags; kept so its pools are reused
+	NTreeXMLTypeTable fXMLTypes;			// element names for WriteXML, node makers for ReadXML
+	NTreeLock fLock;						// readers shared, writers exclusive, if fThreadSafe
+	bool fThreadSafe;						// the lock is used; set by SetThreadSafe
+	std::shared_ptr<TreeAsyncSaves> fAsyncSaves;	// saves WriteAsync has running, nullptr before the first
 
 };
 
+// --------------------------------------------------------------------------------
+/*
+	* VisitAllNTreeNodes
+
+	Same as the NTreeNodeActionFunc version, but inAction may be any callable
+	taking an NTreeNodePtr and returning a bool (true to abort) or an
+	NTreeVisitResult.  Its state is captured by the callable instead of being
+	passed through a void*.
+*/
+// --------------------------------------------------------------------------------
+template <class Action>
+bool NTree::VisitAllNTreeNodes
+(
+	NTreeNodePtr inStartNode,
+	Action inAction,
+	bool inActionOnEntry,
+	bool inDoOnlyThisBranch
+)
+{
+	NTreeReadLock
+		lock(GetTreeFromNode(inStartNode));
+	NTreeTraversalContextHolder
+		context;
+	NTreeNoAction
+		none;
+
+	return inActionOnEntry ?
+		NTreeVisitNodes(*context, inStartNode, inAction, none, inDoOnlyThisBranch) :
+		NTreeVisitNodes(*context, inStartNode, none, inAction, inDoOnlyThisBranch);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* VisitAllNTreeNodes
+
+	Calls inEntryAction on each node before its children and inExitAction after
+	them, in a single pass.  Either may be NTreeNoAction().
+*/
+// --------------------------------------------------------------------------------
+template <class EntryAction, class ExitAction, class>
+bool NTree::VisitAllNTreeNodes
+(
+	NTreeNodePtr inStartNode,
+	EntryAction inEntryAction,
+	ExitAction inExitAction,
+	bool inDoOnlyThisBranch
+)
+{
+	NTreeReadLock
+		lock(GetTreeFromNode(inStartNode));
+	NTreeTraversalContextHolder
+		context;
+
+	return NTreeVisitNodes(*context, inStartNode, inEntryAction, inExitAction, inDoOnlyThisBranch);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* CreateNode
+
+	Constructs a T (NTreeNode or a subclass) from inArgs in the tree's arena.
+	Returns nullptr if out of memory.  The node is not inserted anywhere.
+
+	Delete the node with DeleteNode() or Prune(), never with delete.  Its memory
+	belongs to this tree, so it may not outlive the tree or be moved to another.
+*/
+// --------------------------------------------------------------------------------
+template <class T, class... Args>
+T* NTree::CreateNode(Args&&... inArgs)
+{
+	static_assert(std::is_base_of<NTreeNode, T>::value, "CreateNode makes NTreeNodes");
+	static_assert(alignof(T) <= NTreeNodeArena::kAlignment, "node type needs more alignment than the arena gives");
+
+	void*
+		memory = fArena.Allocate(sizeof(T));
+	T*
+		node = nullptr;
+
+	if (memory != nullptr)
+	{
+		node = new (memory) T(std::forward<Args>(inArgs)...);
+		node->SetArena(&fArena);
+	}
+
+	return node;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* NTreeRecordCopy::Capture
+
+	Takes inNode's type, ID and flags, and its record as written at inVersion.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+template <class Base>
+long NTreeRecordCopy<Base>::Capture(NTreeNodePtr inNode, long inVersion)
+{
+	long
+		offset = 0;
+
+	this->SetType(inNode->GetType());
+	this->SetID(inNode->GetID());
+	this->SetFlags(inNode->GetFlags());
+
+	fVersion = inVersion;
+	fRecord.clear();
+
+	return inNode->Write(&fRecord, offset, inVersion, CaptureCB);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* NTreeRecordCopy::Write
+
+	Writes the record Capture took.  It can't be written at another version.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+template <class Base>
+long NTreeRecordCopy<Base>::Write(void* inFile, long& ioOffset, long inVersion, NTreeNodeWriteCB inWriteCB)
+{
+	long
+		error = 0;
+
+	if (inVersion != fVersion)
+	{
+		return -1;
+	}
+
+	if (!fRecord.empty())
+	{
+		error = (*inWriteCB)(inFile, fRecord.data(), static_cast<unsigned long>(fRecord.size()), 1, ioOffset);
+		if (error == 0)
+		{
+			ioOffset += long(fRecord.size());
+		}
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	* NTreeRecordCopy::CaptureCB
+
+	An NTreeNodeWriteCB that writes into the std::vector<unsigned char> inFile.
+*/
+// --------------------------------------------------------------------------------
+template <class Base>
+long NTreeRecordCopy<Base>::CaptureCB(void* inFile, void* inData, unsigned long inSize, unsigned long inCount, long inOffset)
+{
+	std::vector<unsigned char>*
+		record = static_cast<std::vector<unsigned char>*>(inFile);
+	size_t
+		size = size_t(inSize) * inCount;
+
+	if (inOffset < 0)
+	{
+		return -1;
+	}
+
+	if (record->size() < size_t(inOffset) + size)
+	{
+		record->resize(size_t(inOffset) + size);
+	}
+	memcpy(record->data() + inOffset, inData, size);
+
+	return 0;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,303 @@
+// --------------------------------------------------------------------------------
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeBufferedIO.h"
+#include <cstring>
+
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeBufferedWriter
+
+	inFile and inWriteCB are what would otherwise be passed to NTreeNode::Write.
+*/
+// --------------------------------------------------------------------------------
+NTreeBufferedWriter::NTreeBufferedWriter
+(
+	void* inFile,
+	NTreeNodeWriteCB inWriteCB,
+	size_t inChunkSize
+)
+{
+	fFile = inFile;
+	fWriteCB = inWriteCB;
+	fChunk.resize((inChunkSize > 0) ? inChunkSize : size_t(kDefaultChunkSize));
+	fUsed = 0;
+	fChunkOffset = 0;
+	fError = 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeBufferedWriter
+
+	Flushes anything still waiting, as a last resort.  Call Flush() first to
+	find out whether it worked.
+*/
+// --------------------------------------------------------------------------------
+NTreeBufferedWriter::~NTreeBufferedWriter()
+{
+	Flush();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Write
+
+	Adds inSize bytes at inData, meant for file offset inOffset, to the chunk.
+	The chunk goes to the callback when it fills up.  Writes bigger than a chunk
+	go straight to the callback.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeBufferedWriter::Write
+(
+	const void* inData,
+	unsigned long inSize,
+	long inOffset
+)
+{
+	long
+		error = fError;
+
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	/* Not where the chunk leaves off, or no room left: start a new chunk. */
+	if ((fUsed > 0) && ((inOffset != fChunkOffset + long(fUsed)) || (inSize > fChunk.size() - fUsed)))
+	{
+		error = Flush();
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+	}
+
+	if (inSize > fChunk.size())
+	{
+		error = (*fWriteCB)(fFile, const_cast<void*>(inData), inSize, 1, inOffset);
+		fError = error;
+		goto ErrorExit;
+	}
+
+	if (fUsed == 0)
+	{
+		fChunkOffset = inOffset;
+	}
+
+	memcpy(fChunk.data() + fUsed, inData, inSize);
+	fUsed += inSize;
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Flush
+
+	Passes whatever is waiting in the chunk to the callback.
+
+	Returns 0 if no error, or the first error the callback returned.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeBufferedWriter::Flush(void)
+{
+	if ((fUsed > 0) && (fError == 0))
+	{
+		fError = (*fWriteCB)(fFile, fChunk.data(), static_cast<unsigned long>(fUsed), 1, fChunkOffset);
+	}
+
+	fUsed = 0;
+
+	return fError;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	WriteCB
+
+	The callback to pass to NTreeNode::Write along with the writer as the file.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeBufferedWriter::WriteCB
+(
+	void* inWriter,
+	void* inData,
+	unsigned long inSize,
+	unsigned long inCount,
+	long inOffset
+)
+{
+	return static_cast<NTreeBufferedWriter*>(inWriter)->Write(inData, inSize * inCount, inOffset);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeBufferedReader
+
+	inFile and inReadCB are what would otherwise be passed to NTreeNode::Read.
+*/
+// --------------------------------------------------------------------------------
+NTreeBufferedReader::NTreeBufferedReader
+(
+	void* inFile,
+	NTreeNodeReadCB inReadCB,
+	size_t inBlockSize
+)
+{
+	fFile = inFile;
+	fReadCB = inReadCB;
+	fBlock.resize((inBlockSize > 0) ? inBlockSize : size_t(kDefaultBlockSize));
+	fValid = 0;
+	fBlockOffset = 0;
+	fReadSize = fBlock.size();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeBufferedReader
+*/
+// --------------------------------------------------------------------------------
+NTreeBufferedReader::~NTreeBufferedReader()
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Read
+
+	Copies inSize bytes from file offset inOffset to outData.  They come from
+	the block when it holds them; otherwise a new block is read starting at
+	inOffset.  Reads bigger than a block go straight to the callback.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeBufferedReader::Read
+(
+	void* outData,
+	unsigned long inSize,
+	long inOffset
+)
+{
+	long
+		error = 0;
+
+	if ((inOffset < fBlockOffset) || (inOffset - fBlockOffset > long(fValid)) || (inSize > fValid - size_t(inOffset - fBlockOffset)))
+	{
+		if (inSize > fBlock.size())
+		{
+			error = (*fReadCB)(fFile, outData, inSize, 1, inOffset);
+			goto ErrorExit;
+		}
+
+		error = FillBlock(inOffset, inSize);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+	}
+
+	memcpy(outData, fBlock.data() + (inOffset - fBlockOffset), inSize);
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	FillBlock
+
+	Reads a block starting at inOffset that holds at least inNeeded bytes.  If
+	the callback fails, the block is halved and tried again until only inNeeded
+	bytes are asked for; the smaller size is kept for the reads that follow, as
+	they are likely to be near the end of the file too.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeBufferedReader::FillBlock
+(
+	long inOffset,
+	unsigned long inNeeded
+)
+{
+	long
+		error = 0;
+	size_t
+		size = (fReadSize > inNeeded) ? fReadSize : size_t(inNeeded);
+
+	fValid = 0;
+	fBlockOffset = inOffset;
+
+	for (;;)
+	{
+		error = (*fReadCB)(fFile, fBlock.data(), static_cast<unsigned long>(size), 1, inOffset);
+		if ((error == 0) || (size <= inNeeded))
+		{
+			break;
+		}
+
+		size = (size / 2 > inNeeded) ? size / 2 : size_t(inNeeded);
+		fReadSize = size;
+	}
+
+	if (error == 0)
+	{
+		fValid = size;
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadCB
+
+	The callback to pass to NTreeNode::Read along with the reader as the file.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeBufferedReader::ReadCB
+(
+	void* inReader,
+	void* outData,
+	unsigned long inSize,
+	unsigned long inCount,
+	long inOffset
+)
+{
+	return static_cast<NTreeBufferedReader*>(inReader)->Read(outData, inSize * inCount, inOffset);
+}
@@ -0,0 +1,119 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREEBUFFEREDIO_
+#define _NTREEBUFFEREDIO_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeBufferedIO.h
+
+		NTreeNode::Write hands each field of a node to the write callback on its
+		own, a few bytes at a time.  NTreeBufferedWriter sits between the nodes and
+		the application's callback: it packs those small writes into a large chunk
+		and calls the real callback only when the chunk is full or is flushed.
+
+		It stands in for the file.  Pass the writer as the file and
+		NTreeBufferedWriter::WriteCB as the callback, and node code (including
+		subclasses' Write) works unchanged.  NTree::Write does this itself and
+		flushes before it returns.
+
+		Writes are expected in order.  One at an offset other than the end of the
+		chunk flushes the chunk and starts a new one there.
+
+		NTreeBufferedReader does the same for NTreeNode::Read.  It reads ahead a
+		large block through the application's read callback and serves the nodes'
+		small reads from memory.  Near the end of the file, where a full block
+		can't be read, it asks for smaller and smaller blocks, down to just the
+		bytes needed, so any callback that reads exactly what it is asked for
+		works as the block source.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <cstddef>
+#include <vector>
+#include "NTreeNode.h"
+
+class NTreeBufferedWriter
+{
+public:
+
+	enum
+	{
+		kDefaultChunkSize = 64 * 1024
+	};
+
+	NTreeBufferedWriter(void*, NTreeNodeWriteCB, size_t = kDefaultChunkSize);
+	~NTreeBufferedWriter();
+
+	long Write(const void*, unsigned long, long);
+	long Flush(void);
+
+	/* An NTreeNodeWriteCB; the file parameter is the NTreeBufferedWriter. */
+	static long WriteCB(void*, void*, unsigned long, unsigned long, long);
+
+private:
+
+	NTreeBufferedWriter(const NTreeBufferedWriter&);
+	NTreeBufferedWriter& operator=(const NTreeBufferedWriter&);
+
+	void* fFile;						// the application's file
+	NTreeNodeWriteCB fWriteCB;			// the application's callback
+	std::vector<unsigned char> fChunk;
+	size_t fUsed;						// bytes waiting in fChunk
+	long fChunkOffset;					// file offset of fChunk[0]
+	long fError;						// first error from fWriteCB; later writes fail with it
+};
+
+class NTreeBufferedReader
+{
+public:
+
+	enum
+	{
+		kDefaultBlockSize = 64 * 1024
+	};
+
+	NTreeBufferedReader(void*, NTreeNodeReadCB, size_t = kDefaultBlockSize);
+	~NTreeBufferedReader();
+
+	long Read(void*, unsigned long, long);
+
+	/* An NTreeNodeReadCB; the file parameter is the NTreeBufferedReader. */
+	static long ReadCB(void*, void*, unsigned long, unsigned long, long);
+
+private:
+
+	NTreeBufferedReader(const NTreeBufferedReader&);
+	NTreeBufferedReader& operator=(const NTreeBufferedReader&);
+
+	long FillBlock(long, unsigned long);
+
+	void* fFile;						// the application's file
+	NTreeNodeReadCB fReadCB;			// the application's callback
+	std::vector<unsigned char> fBlock;
+	size_t fValid;						// bytes of fBlock read from the file
+	long fBlockOffset;					// file offset of fBlock[0]
+	size_t fReadSize;					// bytes to ask for; shrinks after a short read at the end of the file
+};
+
+#endif
@@ -0,0 +1,323 @@
+// --------------------------------------------------------------------------------
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeCompact.h"
+#include "NTreeTraversal.h"
+
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeEncodeVarint
+
+	Puts inValue into outBytes, which has room for kNTreeMaxVarintSize bytes.
+	Returns the number of bytes used.
+*/
+// --------------------------------------------------------------------------------
+size_t NTreeEncodeVarint(uint64_t inValue, unsigned char* outBytes)
+{
+	size_t
+		count = 0;
+
+	while (inValue >= 0x80)
+	{
+		outBytes[count] = static_cast<unsigned char>(inValue | 0x80);
+		inValue >>= 7;
+		count += 1;
+	}
+	outBytes[count] = static_cast<unsigned char>(inValue);
+
+	return count + 1;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeReadVarint
+
+	Reads a varint at ioOffset, a byte at a time, so nothing past it is asked
+	for.  On exit ioOffset is just past it.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTreeReadVarint(void* inFile, NTreeNodeReadCB inReadCB, long& ioOffset, uint64_t& outValue)
+{
+	long
+		error = 0;
+	unsigned char
+		byte = 0x80;
+	unsigned int
+		shift = 0;
+
+	outValue = 0;
+
+	while ((byte & 0x80) != 0)
+	{
+		if (shift >= 64)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+
+		error = (*inReadCB)(inFile, &byte, sizeof(byte), 1, ioOffset);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+		ioOffset += long(sizeof(byte));
+
+		outValue |= uint64_t(byte & 0x7F) << shift;
+		shift += 7;
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeTypeDictionary
+*/
+// --------------------------------------------------------------------------------
+NTreeTypeDictionary::NTreeTypeDictionary(void)
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeTypeDictionary
+*/
+// --------------------------------------------------------------------------------
+NTreeTypeDictionary::~NTreeTypeDictionary()
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Clear
+*/
+// --------------------------------------------------------------------------------
+void NTreeTypeDictionary::Clear(void)
+{
+	fTypes.clear();
+	fIndexByType.clear();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Add
+
+	Gives inType the next index, unless it has one.
+*/
+// --------------------------------------------------------------------------------
+void NTreeTypeDictionary::Add(NTreeNodeType inType)
+{
+	if (fIndexByType.find(inType) == fIndexByType.end())
+	{
+		fIndexByType[inType] = uint32_t(fTypes.size());
+		fTypes.push_back(inType);
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	AddBranch
+
+	Adds the types of inNode and everything under it.
+*/
+// --------------------------------------------------------------------------------
+void NTreeTypeDictionary::AddBranch(NTreeNodePtr inNode)
+{
+	NTreeTraversalContextHolder
+		context;
+	NTreeNoAction
+		exitAction;
+	auto
+		entryAction = [this](NTreeNodePtr inVisited)
+		{
+			Add(inVisited->GetType());
+			return kNTreeVisitContinue;
+		};
+
+	NTreeVisitNodes(*context, inNode, entryAction, exitAction, true);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Write
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTreeTypeDictionary::Write(void* inFile, long& ioOffset, NTreeNodeWriteCB inWriteCB) const
+{
+	long
+		error = 0;
+	uint32_t
+		numTypes = uint32_t(fTypes.size());
+
+	error = (*inWriteCB)(inFile, &numTypes, sizeof(numTypes), 1, ioOffset);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+	ioOffset += long(sizeof(numTypes));
+
+	if (numTypes > 0)
+	{
+		error = (*inWriteCB)(inFile, const_cast<NTreeNodeType*>(fTypes.data()), static_cast<unsigned long>(numTypes * sizeof(NTreeNodeType)), 1, ioOffset);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+		ioOffset += long(numTypes * sizeof(NTreeNodeType));
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Read
+
+	Replaces the dictionary with the one at ioOffset.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTreeTypeDictionary::Read(void* inFile, long& ioOffset, NTreeNodeReadCB inReadCB)
+{
+	long
+		error = 0;
+	uint32_t
+		numTypes = 0;
+	std::vector<NTreeNodeType>
+		types;
+	uint32_t
+		i;
+
+	Clear();
+
+	error = (*inReadCB)(inFile, &numTypes, sizeof(numTypes), 1, ioOffset);
+	if ((error == 0) && (numTypes > uint32_t(kMaxTypes)))
+	{
+		error = -1;
+	}
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+	ioOffset += long(sizeof(numTypes));
+
+	types.resize(numTypes);
+	if (numTypes > 0)
+	{
+		error = (*inReadCB)(inFile, types.data(), static_cast<unsigned long>(numTypes * sizeof(NTreeNodeType)), 1, ioOffset);
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+		ioOffset += long(numTypes * sizeof(NTreeNodeType));
+	}
+
+	for (i = 0; i < numTypes; i += 1)
+	{
+		Add(types[i]);
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	WriteType
+
+	Writes inType's index as a varint.  inType must have been added.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTreeTypeDictionary::WriteType(void* inFile, long& ioOffset, NTreeNodeWriteCB inWriteCB, NTreeNodeType inType) const
+{
+	long
+		error = 0;
+	unsigned char
+		bytes[kNTreeMaxVarintSize];
+	size_t
+		count = 0;
+	auto
+		found = fIndexByType.find(inType);
+
+	if (found == fIndexByType.end())
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	count = NTreeEncodeVarint(found->second, bytes);
+	error = (*inWriteCB)(inFile, bytes, static_cast<unsigned long>(count), 1, ioOffset);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+	ioOffset += long(count);
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadType
+
+	Reads a type's index and returns the type in outType.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTreeTypeDictionary::ReadType(void* inFile, long& ioOffset, NTreeNodeReadCB inReadCB, NTreeNodeType& outType) const
+{
+	long
+		error = 0;
+	uint64_t
+		index = 0;
+
+	error = NTreeReadVarint(inFile, inReadCB, ioOffset, index);
+	if ((error == 0) && (index >= fTypes.size()))
+	{
+		error = -1;
+	}
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	outType = fTypes[size_t(index)];
+
+ErrorExit:
+	return error;
+}
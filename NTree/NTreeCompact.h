@@ -0,0 +1,92 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREECOMPACT_
+#define _NTREECOMPACT_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeCompact.h
+
+		Helpers for the compact binary format of kNTreeVersion (7) on.
+
+		Numbers are stored as varints: seven bits per byte, low bits first, with
+		the top bit set on every byte but the last.  Signed numbers are zigzag
+		coded first, so small negative numbers stay short too.
+
+		A tree has only a handful of node types, so instead of each node's type
+		the file holds its index in an NTreeTypeDictionary, which is written once
+		in front of the tree.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "NTreeNode.h"
+
+/* The most bytes a 64-bit varint takes. */
+const size_t kNTreeMaxVarintSize = 10;
+
+size_t NTreeEncodeVarint(uint64_t, unsigned char*);
+long NTreeReadVarint(void*, NTreeNodeReadCB, long&, uint64_t&);
+
+inline uint64_t NTreeZigZag(int64_t inValue) { return (uint64_t(inValue) << 1) ^ uint64_t(inValue >> 63); }
+inline int64_t NTreeUnZigZag(uint64_t inValue) { return int64_t(inValue >> 1) ^ -int64_t(inValue & 1); }
+
+class NTreeTypeDictionary
+{
+public:
+
+	enum
+	{
+		kMaxTypes = 0x10000		// more than this in a file means the file is bad
+	};
+
+	NTreeTypeDictionary(void);
+	~NTreeTypeDictionary();
+
+	void Clear(void);
+	void Add(NTreeNodeType);
+	void AddBranch(NTreeNodePtr);
+	size_t GetNumTypes(void) const { return fTypes.size(); }
+	NTreeNodeType GetType(size_t inIndex) const { return fTypes[inIndex]; }
+
+	/* The dictionary itself: a 32-bit count, then the types. */
+	long Write(void*, long&, NTreeNodeWriteCB) const;
+	long Read(void*, long&, NTreeNodeReadCB);
+
+	/* A node's type, as its index. */
+	long WriteType(void*, long&, NTreeNodeWriteCB, NTreeNodeType) const;
+	long ReadType(void*, long&, NTreeNodeReadCB, NTreeNodeType&) const;
+
+private:
+
+	NTreeTypeDictionary(const NTreeTypeDictionary&);
+	NTreeTypeDictionary& operator=(const NTreeTypeDictionary&);
+
+	std::vector<NTreeNodeType> fTypes;							// in the order they were added
+	std::unordered_map<NTreeNodeType, uint32_t> fIndexByType;
+};
+
+#endif
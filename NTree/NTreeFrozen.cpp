@@ -0,0 +1,627 @@
+// --------------------------------------------------------------------------------
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeFrozen.h"
+#include "NTreeNodeFlags.h"
+#include "NTreeTraversal.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// --------------------------------------------------------------------------------
+/*
+	AlignImageOffset
+
+	Rounds an image offset up to the 8 byte boundary every array starts on.
+*/
+// --------------------------------------------------------------------------------
+static uint64_t
+AlignImageOffset(uint64_t inOffset)
+{
+	return (inOffset + 7) & ~uint64_t(7);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	IsImageArrayInside
+
+	True if an array of inCount fields of inFieldSize bytes at inOffset starts
+	on an 8 byte boundary and ends within an image of inImageSize bytes.
+	Written so that no sum can wrap.
+*/
+// --------------------------------------------------------------------------------
+static bool
+IsImageArrayInside(uint64_t inOffset, int32_t inCount, size_t inFieldSize, uint64_t inImageSize)
+{
+	return ((inOffset & 7) == 0) && (inOffset <= inImageSize)
+		&& (uint64_t(inCount) * inFieldSize <= inImageSize - inOffset);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeFrozen
+*/
+// --------------------------------------------------------------------------------
+NTreeFrozen::NTreeFrozen(void)
+{
+	fMappedView = nullptr;
+	fMappedSize = 0;
+	fImageStart = nullptr;
+	fImageSize = 0;
+	fNumNodes = 0;
+	fNumIDs = 0;
+	fTypes = nullptr;
+	fIDs = nullptr;
+	fFlags = nullptr;
+	fTags = nullptr;
+	fParents = nullptr;
+	fNumChildren = nullptr;
+	fEnds = nullptr;
+	fIndexByID = nullptr;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeFrozen
+*/
+// --------------------------------------------------------------------------------
+NTreeFrozen::~NTreeFrozen()
+{
+	Clear();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Build
+
+	Replaces the contents with a copy of the branch at inStartNode.  If
+	inTagFunc is not nullptr it is called once per node for the node's tag;
+	otherwise the tags are 0.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeFrozen::Build
+(
+	NTreeNodePtr inStartNode,
+	NTreeNodeFreezeTagFunc inTagFunc
+)
+{
+	long
+		error = 0;
+	NTreeTraversalContextHolder
+		context;
+	NTreeFrozenIndex
+		parent = kNone;
+	std::vector<NTreeNodeType>
+		types;
+	std::vector<NTreeNodeID>
+		ids;
+	std::vector<short>
+		flags;
+	std::vector<NTreeFrozenTag>
+		tags;
+	std::vector<NTreeFrozenIndex>
+		parents;
+	std::vector<NTreeChildIndex>
+		numChildren;
+	std::vector<NTreeFrozenIndex>
+		ends;
+	std::vector<NTreeFrozenIndex>
+		indexByID;
+	Header
+		header;
+	size_t
+		i;
+
+	Clear();
+
+	if (inStartNode == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	{
+		/* On entry each node is appended in preorder and becomes the parent of what
+			follows; on exit its branch is complete and the parent steps back up. */
+		auto
+			entryAction = [&](NTreeNodePtr inNode)
+			{
+				NTreeFrozenIndex
+					index = NTreeFrozenIndex(types.size());
+
+				types.push_back(inNode->GetType());
+				ids.push_back(inNode->GetID());
+				flags.push_back(short(inNode->GetFlags() & ~kNTreeNodeFlagDirty));
+				tags.push_back((inTagFunc != nullptr) ? (*inTagFunc)(inNode) : 0);
+				parents.push_back(parent);
+				numChildren.push_back(inNode->GetNumChildren());
+				ends.push_back(kNone);
+
+				parent = index;
+				return kNTreeVisitContinue;
+			};
+		auto
+			exitAction = [&](NTreeNodePtr)
+			{
+				ends[parent] = NTreeFrozenIndex(types.size());
+				parent = parents[parent];
+				return kNTreeVisitContinue;
+			};
+
+		NTreeVisitNodes(*context, inStartNode, entryAction, exitAction, true);
+	}
+
+	/* ID lookup table.  The root's ID is far past the others, so it isn't in it. */
+	for (i = 0; i < ids.size(); i += 1)
+	{
+		if (ids[i] != kNTreeMaxNodeID)
+		{
+			if (ids[i] >= indexByID.size())
+			{
+				indexByID.resize(size_t(ids[i]) + 1, kNone);
+			}
+			indexByID[ids[i]] = NTreeFrozenIndex(i);
+		}
+	}
+
+	/* Lay out the image: the header, then each array on an 8 byte boundary. */
+	memset(&header, 0, sizeof(header));
+	header.magic = kMagic;
+	header.version = kNTreeVersion;
+	header.headerSize = sizeof(Header);
+	header.idSize = sizeof(NTreeNodeID);
+	header.childIndexSize = sizeof(NTreeChildIndex);
+	header.numNodes = NTreeFrozenIndex(types.size());
+	header.numIDs = NTreeFrozenIndex(indexByID.size());
+	header.typesOffset = AlignImageOffset(sizeof(Header));
+	header.idsOffset = AlignImageOffset(header.typesOffset + types.size() * sizeof(NTreeNodeType));
+	header.flagsOffset = AlignImageOffset(header.idsOffset + ids.size() * sizeof(NTreeNodeID));
+	header.tagsOffset = AlignImageOffset(header.flagsOffset + flags.size() * sizeof(short));
+	header.parentsOffset = AlignImageOffset(header.tagsOffset + tags.size() * sizeof(NTreeFrozenTag));
+	header.numChildrenOffset = AlignImageOffset(header.parentsOffset + parents.size() * sizeof(NTreeFrozenIndex));
+	header.endsOffset = AlignImageOffset(header.numChildrenOffset + numChildren.size() * sizeof(NTreeChildIndex));
+	header.indexByIDOffset = AlignImageOffset(header.endsOffset + ends.size() * sizeof(NTreeFrozenIndex));
+	header.imageSize = AlignImageOffset(header.indexByIDOffset + indexByID.size() * sizeof(NTreeFrozenIndex));
+
+	fImage.assign(size_t(header.imageSize / sizeof(uint64_t)), 0);
+
+	{
+		unsigned char*
+			image = reinterpret_cast<unsigned char*>(fImage.data());
+
+		memcpy(image, &header, sizeof(header));
+		memcpy(image + header.typesOffset, types.data(), types.size() * sizeof(NTreeNodeType));
+		memcpy(image + header.idsOffset, ids.data(), ids.size() * sizeof(NTreeNodeID));
+		memcpy(image + header.flagsOffset, flags.data(), flags.size() * sizeof(short));
+		memcpy(image + header.tagsOffset, tags.data(), tags.size() * sizeof(NTreeFrozenTag));
+		memcpy(image + header.parentsOffset, parents.data(), parents.size() * sizeof(NTreeFrozenIndex));
+		memcpy(image + header.numChildrenOffset, numChildren.data(), numChildren.size() * sizeof(NTreeChildIndex));
+		memcpy(image + header.endsOffset, ends.data(), ends.size() * sizeof(NTreeFrozenIndex));
+		if (!indexByID.empty())
+		{
+			memcpy(image + header.indexByIDOffset, indexByID.data(), indexByID.size() * sizeof(NTreeFrozenIndex));
+		}
+
+		error = Attach(image, size_t(header.imageSize));
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Clear
+
+	Empties the copy, freeing the image or unmapping the file.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeFrozen::Clear(void)
+{
+	Unmap();
+	std::vector<uint64_t>().swap(fImage);
+
+	fImageStart = nullptr;
+	fImageSize = 0;
+	fNumNodes = 0;
+	fNumIDs = 0;
+	fTypes = nullptr;
+	fIDs = nullptr;
+	fFlags = nullptr;
+	fTags = nullptr;
+	fParents = nullptr;
+	fNumChildren = nullptr;
+	fEnds = nullptr;
+	fIndexByID = nullptr;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Attach
+
+	Uses the image at inImage, inSize bytes long, in place.  The image must be
+	8 byte aligned and stay valid and unchanged until Clear() or the copy is
+	destroyed.
+
+	A truncated or damaged image is refused rather than read out of bounds:
+	every array has to lie within the image, and every parent, branch end
+	and ID table entry has to name a node of the copy.  Checking those takes
+	one pass over the structure arrays and the ID table; types, IDs, flags and
+	tags are used as they are.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeFrozen::Attach
+(
+	const void* inImage,
+	size_t inSize
+)
+{
+	long
+		error = 0;
+	const unsigned char*
+		image = static_cast<const unsigned char*>(inImage);
+	const Header*
+		header = static_cast<const Header*>(inImage);
+
+	if ((image == nullptr) || (inSize < sizeof(Header)) || ((reinterpret_cast<uintptr_t>(image) & 7) != 0))
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	/* A magic number that reads backwards was written with the other byte order. */
+	if ((header->magic != uint32_t(kMagic)) || (header->version > kNTreeVersion) || (header->headerSize != sizeof(Header)))
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	/* An image from a build with the other width of NTreeNodeID. */
+	if ((header->idSize != sizeof(NTreeNodeID)) || (header->childIndexSize != sizeof(NTreeChildIndex)))
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	if ((header->imageSize > inSize) || (header->imageSize < sizeof(Header)) || (header->numNodes < 0) || (header->numIDs < 0)
+		|| !IsImageArrayInside(header->typesOffset, header->numNodes, sizeof(NTreeNodeType), header->imageSize)
+		|| !IsImageArrayInside(header->idsOffset, header->numNodes, sizeof(NTreeNodeID), header->imageSize)
+		|| !IsImageArrayInside(header->flagsOffset, header->numNodes, sizeof(short), header->imageSize)
+		|| !IsImageArrayInside(header->tagsOffset, header->numNodes, sizeof(NTreeFrozenTag), header->imageSize)
+		|| !IsImageArrayInside(header->parentsOffset, header->numNodes, sizeof(NTreeFrozenIndex), header->imageSize)
+		|| !IsImageArrayInside(header->numChildrenOffset, header->numNodes, sizeof(NTreeChildIndex), header->imageSize)
+		|| !IsImageArrayInside(header->endsOffset, header->numNodes, sizeof(NTreeFrozenIndex), header->imageSize)
+		|| !IsImageArrayInside(header->indexByIDOffset, header->numIDs, sizeof(NTreeFrozenIndex), header->imageSize))
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	{
+		const NTreeFrozenIndex*
+			parents = reinterpret_cast<const NTreeFrozenIndex*>(image + header->parentsOffset);
+		const NTreeChildIndex*
+			numChildren = reinterpret_cast<const NTreeChildIndex*>(image + header->numChildrenOffset);
+		const NTreeFrozenIndex*
+			ends = reinterpret_cast<const NTreeFrozenIndex*>(image + header->endsOffset);
+		const NTreeFrozenIndex*
+			indexByID = reinterpret_cast<const NTreeFrozenIndex*>(image + header->indexByIDOffset);
+		NTreeFrozenIndex
+			i;
+
+		/* In preorder a parent comes before its children, and a branch ends after
+			its first node and within its parent's.  Walks over siblings rely on it. */
+		for (i = 0; i < header->numNodes; i += 1)
+		{
+			if ((ends[i] <= i) || (ends[i] > header->numNodes) || (numChildren[i] < 0)
+				|| ((numChildren[i] == 0) != (ends[i] == i + 1)))
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+
+			if ((i == 0) ? (parents[i] != kNone) : ((parents[i] < 0) || (parents[i] >= i) || (ends[i] > ends[parents[i]])))
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+		}
+
+		for (i = 0; i < header->numIDs; i += 1)
+		{
+			if ((indexByID[i] != kNone) && ((indexByID[i] < 0) || (indexByID[i] >= header->numNodes)))
+			{
+				error = -1;
+				goto ErrorExit;
+			}
+		}
+	}
+
+	fImageStart = image;
+	fImageSize = size_t(header->imageSize);
+	fNumNodes = header->numNodes;
+	fNumIDs = header->numIDs;
+	fTypes = reinterpret_cast<const NTreeNodeType*>(image + header->typesOffset);
+	fIDs = reinterpret_cast<const NTreeNodeID*>(image + header->idsOffset);
+	fFlags = reinterpret_cast<const short*>(image + header->flagsOffset);
+	fTags = reinterpret_cast<const NTreeFrozenTag*>(image + header->tagsOffset);
+	fParents = reinterpret_cast<const NTreeFrozenIndex*>(image + header->parentsOffset);
+	fNumChildren = reinterpret_cast<const NTreeChildIndex*>(image + header->numChildrenOffset);
+	fEnds = reinterpret_cast<const NTreeFrozenIndex*>(image + header->endsOffset);
+	fIndexByID = reinterpret_cast<const NTreeFrozenIndex*>(image + header->indexByIDOffset);
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Save
+
+	Writes the image to the file at inPath, replacing it.
+
+	The tags are written as they are.  Tags that are pointers (as in the
+	Sample's SpellChecker) don't survive the process that made them, so only
+	save copies tagged with values.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeFrozen::Save(const char* inPath) const
+{
+	long
+		error = 0;
+	FILE*
+		file = nullptr;
+
+	if (fImageStart == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+#ifdef _WIN32
+	if (fopen_s(&file, inPath, "wb") != 0)
+	{
+		file = nullptr;
+	}
+#else
+	file = fopen(inPath, "wb");
+#endif
+	if (file == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	if (fwrite(fImageStart, 1, fImageSize, file) != fImageSize)
+	{
+		error = -1;
+	}
+
+	if (fclose(file) != 0)
+	{
+		error = -1;
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Open
+
+	Replaces the contents with the image in the file at inPath, mapped read-only
+	and used in place.  The file stays mapped until Clear() or the copy is
+	destroyed.  The image is checked as Attach() describes.  Its tags are the
+	values that were saved; if they were pointers, they point nowhere now.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeFrozen::Open(const char* inPath)
+{
+	long
+		error = 0;
+
+	Clear();
+
+#ifdef _WIN32
+	{
+		HANDLE
+			file = CreateFileA(inPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		HANDLE
+			mapping = nullptr;
+		LARGE_INTEGER
+			size;
+
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+
+		if (!GetFileSizeEx(file, &size) || (size.QuadPart == 0) || (uint64_t(size.QuadPart) > SIZE_MAX))
+		{
+			CloseHandle(file);
+			error = -1;
+			goto ErrorExit;
+		}
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+		{
+			fMappedView = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			fMappedSize = size_t(size.QuadPart);
+		}
+
+		/* The view keeps the file open. */
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+	}
+#else
+	{
+		int
+			file = open(inPath, O_RDONLY);
+		struct stat
+			info;
+		void*
+			view = MAP_FAILED;
+
+		if (file < 0)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+
+		if ((fstat(file, &info) == 0) && (info.st_size > 0))
+		{
+			view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+		}
+
+		/* The mapping keeps the file open. */
+		close(file);
+
+		if (view != MAP_FAILED)
+		{
+			fMappedView = view;
+			fMappedSize = size_t(info.st_size);
+		}
+	}
+#endif
+
+	if (fMappedView == nullptr)
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+
+	error = Attach(fMappedView, fMappedSize);
+	if (error != 0)
+	{
+		Unmap();
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Unmap
+
+	Unmaps the file opened with Open(), if any.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeFrozen::Unmap(void)
+{
+	if (fMappedView != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(fMappedView);
+#else
+		munmap(fMappedView, fMappedSize);
+#endif
+		fMappedView = nullptr;
+		fMappedSize = 0;
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	FindNodeByID
+
+	Returns the index of the node with ID inID, or kNone.
+*/
+// --------------------------------------------------------------------------------
+NTreeFrozenIndex
+NTreeFrozen::FindNodeByID(NTreeNodeID inID) const
+{
+	if (size_t(inID) < size_t(fNumIDs))
+	{
+		return fIndexByID[inID];
+	}
+
+	if ((fNumNodes > 0) && (fIDs[0] == inID))
+	{
+		return 0;
+	}
+
+	return kNone;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	FindChild
+
+	Returns the index of the first child of inParent with type inType and tag
+	inTag, or kNone.  Steps from child to child by jumping over their branches.
+*/
+// --------------------------------------------------------------------------------
+NTreeFrozenIndex
+NTreeFrozen::FindChild
+(
+	NTreeFrozenIndex inParent,
+	NTreeNodeType inType,
+	NTreeFrozenTag inTag
+) const
+{
+	NTreeFrozenIndex
+		i,
+		end = fEnds[inParent];
+
+	for (i = inParent + 1; i < end; i = fEnds[i])
+	{
+		if ((fTypes[i] == inType) && (fTags[i] == inTag))
+		{
+			return i;
+		}
+	}
+
+	return kNone;
+}
@@ -0,0 +1,216 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREEFROZEN_
+#define _NTREEFROZEN_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeFrozen.h
+
+		A NTreeFrozen is a read-only copy of a tree (or a branch of one) laid out
+		flat for fast reading.  Nodes are numbered in preorder, 0 being the node the
+		copy was made from, and each field lives in its own array indexed by that
+		number: type, ID, flags, parent, child count, tag, and the end of the node's
+		branch.
+
+		Preorder numbering makes most questions index arithmetic:
+
+			- a node's first child, if it has any, is the next node (index + 1);
+			- a node's branch is the run of nodes from index up to GetEnd(index);
+			- a node's next sibling starts where its branch ends.
+
+		So walking a branch is a loop over an index range and descending to a child
+		is a few compares, without virtual calls or pointer chasing.
+
+		The tag is a value the application picks for each node when the copy is made
+		(a letter, a key, a pointer to its data...) so that it can search the copy
+		without going back to the NTreeNodes.
+
+		Make one with NTree::Freeze() or Build().  It doesn't follow later changes to
+		the tree; build it again after editing.
+
+		All of a copy lives in one block, the image: a header followed by the arrays,
+		each of fixed-width fields at an offset from the start of the image.  There
+		are no pointers in it, so Save() writes it to a file as is, and Open() maps
+		the file into memory and uses it in place.  Nothing is copied or unpacked;
+		opening only checks that the structure stays within the image, the other
+		arrays are only read from disk when touched, and every process that opens
+		the same file shares the same pages.  Tags that are pointers mean nothing
+		once saved; only save copies tagged with values.
+
+		Images are written in the byte order and NTreeNodeID width of the machine and
+		build that wrote them, and Open() refuses any other.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "NTreeNode.h"
+
+/* Preorder position of a node in a NTreeFrozen. */
+typedef int32_t NTreeFrozenIndex;
+
+/* Application value stored with each node; big enough for a pointer. */
+typedef uint64_t NTreeFrozenTag;
+
+/* Returns the tag to store for a node. */
+typedef NTreeFrozenTag (*NTreeNodeFreezeTagFunc)(NTreeNodePtr);
+
+class NTreeFrozen
+{
+public:
+
+	enum
+	{
+		kNone = -1,				// no such node
+		kMagic = 'NTFZ'			// first four bytes of an image
+	};
+
+	NTreeFrozen(void);
+	~NTreeFrozen();
+
+	long Build(NTreeNodePtr, NTreeNodeFreezeTagFunc = nullptr);
+	void Clear(void);
+
+	/* Persistence */
+	long Save(const char*) const;
+	long Open(const char*);
+	long Attach(const void*, size_t);
+	const void* GetImage(void) const { return fImageStart; }
+	size_t GetImageSize(void) const { return fImageSize; }
+
+	/* Nodes */
+	NTreeFrozenIndex GetNumNodes(void) const { return fNumNodes; }
+	NTreeFrozenIndex GetRoot(void) const { return (fNumNodes > 0) ? 0 : NTreeFrozenIndex(kNone); }
+	NTreeFrozenIndex FindNodeByID(NTreeNodeID) const;
+
+	/* Fields */
+	NTreeNodeType GetType(NTreeFrozenIndex inIndex) const { return fTypes[inIndex]; }
+	NTreeNodeID GetID(NTreeFrozenIndex inIndex) const { return fIDs[inIndex]; }
+	short GetFlags(NTreeFrozenIndex inIndex) const { return fFlags[inIndex]; }
+	NTreeFrozenTag GetTag(NTreeFrozenIndex inIndex) const { return fTags[inIndex]; }
+
+	/* Structure */
+	NTreeFrozenIndex GetParent(NTreeFrozenIndex inIndex) const { return fParents[inIndex]; }
+	NTreeChildIndex GetNumChildren(NTreeFrozenIndex inIndex) const { return fNumChildren[inIndex]; }
+	NTreeFrozenIndex GetEnd(NTreeFrozenIndex inIndex) const { return fEnds[inIndex]; }
+	NTreeFrozenIndex GetFirstChild(NTreeFrozenIndex inIndex) const
+	{
+		return (fNumChildren[inIndex] > 0) ? inIndex + 1 : NTreeFrozenIndex(kNone);
+	}
+	NTreeFrozenIndex GetNextSibling(NTreeFrozenIndex inIndex) const
+	{
+		NTreeFrozenIndex
+			parent = fParents[inIndex];
+
+		return ((parent != kNone) && (fEnds[inIndex] < fEnds[parent])) ? fEnds[inIndex] : NTreeFrozenIndex(kNone);
+	}
+	NTreeFrozenIndex FindChild(NTreeFrozenIndex, NTreeNodeType, NTreeFrozenTag) const;
+
+	/* Calls inAction with the index of each node of the branch at inStart, in preorder.
+		Stops, and returns true, when inAction returns true. */
+	template <class Action>
+	bool Visit(NTreeFrozenIndex inStart, Action inAction) const
+	{
+		NTreeFrozenIndex
+			i,
+			end = fEnds[inStart];
+
+		for (i = inStart; i < end; i += 1)
+		{
+			if (inAction(i))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+private:
+
+	/* The start of an image.  Offsets are from the start of the image, and
+		every array starts on an 8 byte boundary. */
+	struct Header
+	{
+		uint32_t
+			magic;				// kMagic
+		uint32_t
+			version;			// kNTreeVersion of the writer
+		uint32_t
+			headerSize;			// sizeof(Header)
+		uint16_t
+			idSize;				// sizeof(NTreeNodeID)
+		uint16_t
+			childIndexSize;		// sizeof(NTreeChildIndex)
+		int32_t
+			numNodes;
+		int32_t
+			numIDs;				// entries in the ID table
+		uint64_t
+			imageSize;
+		uint64_t
+			typesOffset;
+		uint64_t
+			idsOffset;
+		uint64_t
+			flagsOffset;
+		uint64_t
+			tagsOffset;
+		uint64_t
+			parentsOffset;
+		uint64_t
+			numChildrenOffset;
+		uint64_t
+			endsOffset;
+		uint64_t
+			indexByIDOffset;
+	};
+	typedef struct Header Header;
+
+	/* The arrays point into the image, so a copy can't be copied. */
+	NTreeFrozen(const NTreeFrozen&);
+	NTreeFrozen& operator=(const NTreeFrozen&);
+
+	void Unmap(void);
+
+	std::vector<uint64_t> fImage;		// the image, when built in memory
+	void* fMappedView;					// the image, when opened from a file
+	size_t fMappedSize;
+	const unsigned char* fImageStart;	// whichever of the two is in use
+	size_t fImageSize;
+
+	NTreeFrozenIndex fNumNodes;
+	NTreeFrozenIndex fNumIDs;
+	const NTreeNodeType* fTypes;
+	const NTreeNodeID* fIDs;
+	const short* fFlags;
+	const NTreeFrozenTag* fTags;
+	const NTreeFrozenIndex* fParents;		// kNone for node 0
+	const NTreeChildIndex* fNumChildren;
+	const NTreeFrozenIndex* fEnds;		// one past the last node of the branch
+	const NTreeFrozenIndex* fIndexByID;	// kNone for IDs not in the copy
+};
+
+#endif
@@ -0,0 +1,321 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeLock.h"
+#include "NTree.h"
+
+/* The locks the calling thread holds shared, and how many times. */
+struct NTreeSharedHold
+{
+	const NTreeLock*
+		lock;
+	unsigned long
+		depth;
+};
+typedef struct NTreeSharedHold NTreeSharedHold;
+
+static thread_local std::vector<NTreeSharedHold> sSharedHolds;
+
+static NTreeSharedHold* FindSharedHold(const NTreeLock*);
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeLock
+*/
+// --------------------------------------------------------------------------------
+NTreeLock::NTreeLock(void)
+{
+	fWriter.store(std::thread::id());
+	fWriteDepth = 0;
+	fWritersWaiting.store(0);
+	fWriteCount.store(0);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeLock
+*/
+// --------------------------------------------------------------------------------
+NTreeLock::~NTreeLock()
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	LockShared
+
+	Waits until no thread holds the lock exclusive or is waiting to, then
+	holds it shared.  Does nothing more if this thread holds it already.
+*/
+// --------------------------------------------------------------------------------
+void NTreeLock::LockShared(void)
+{
+	NTreeSharedHold*
+		hold = nullptr;
+	NTreeSharedHold
+		newHold;
+
+	if (IsLockedByThisThread())
+	{
+		return;
+	}
+
+	hold = FindSharedHold(this);
+	if (hold != nullptr)
+	{
+		hold->depth += 1;
+		return;
+	}
+
+	if (fWritersWaiting.load() != 0)
+	{
+		std::unique_lock<std::mutex>
+			gate(fGateMutex);
+
+		fGate.wait(gate, [this](void) { return fWritersWaiting.load() == 0; });
+	}
+
+	fMutex.lock_shared();
+
+	newHold.lock = this;
+	newHold.depth = 1;
+	sSharedHolds.push_back(newHold);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	UnlockShared
+
+	Undoes one LockShared.
+*/
+// --------------------------------------------------------------------------------
+void NTreeLock::UnlockShared(void)
+{
+	NTreeSharedHold*
+		hold = nullptr;
+
+	if (IsLockedByThisThread())
+	{
+		return;
+	}
+
+	hold = FindSharedHold(this);
+	if (hold == nullptr)
+	{
+		return;
+	}
+
+	hold->depth -= 1;
+	if (hold->depth == 0)
+	{
+		/* The holds come and go in order, so this is almost always the last one. */
+		*hold = sSharedHolds.back();
+		sSharedHolds.pop_back();
+		fMutex.unlock_shared();
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Lock
+
+	Waits until no other thread holds the lock, then holds it exclusive.  Does
+	nothing more if this thread holds it exclusive already.
+
+	Returns non-zero, without waiting, if this thread holds it shared.
+*/
+// --------------------------------------------------------------------------------
+long NTreeLock::Lock(void)
+{
+	if (IsLockedByThisThread())
+	{
+		fWriteDepth += 1;
+		return 0;
+	}
+
+	if (FindSharedHold(this) != nullptr)
+	{
+		return -1;
+	}
+
+	fWritersWaiting += 1;
+	fMutex.lock();
+	fWriter.store(std::this_thread::get_id());
+	fWriteDepth = 1;
+
+	/* Readers let in now still wait on fMutex until Unlock. */
+	if (--fWritersWaiting == 0)
+	{
+		std::lock_guard<std::mutex>
+			gate(fGateMutex);
+
+		fGate.notify_all();
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Unlock
+
+	Undoes one successful Lock.
+*/
+// --------------------------------------------------------------------------------
+void NTreeLock::Unlock(void)
+{
+	if (!IsLockedByThisThread())
+	{
+		return;
+	}
+
+	fWriteDepth -= 1;
+	if (fWriteDepth == 0)
+	{
+		fWriteCount += 1;
+		fWriter.store(std::thread::id());
+		fMutex.unlock();
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	IsLockedByThisThread
+
+	True if this thread holds the lock exclusive.
+*/
+// --------------------------------------------------------------------------------
+bool NTreeLock::IsLockedByThisThread(void) const
+{
+	return fWriter.load() == std::this_thread::get_id();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	IsReadLockedByThisThread
+
+	True if this thread holds the lock shared, and not exclusive.
+*/
+// --------------------------------------------------------------------------------
+bool NTreeLock::IsReadLockedByThisThread(void) const
+{
+	return !IsLockedByThisThread() && (FindSharedHold(this) != nullptr);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	FindSharedHold
+
+	This thread's hold on inLock, or nullptr if it doesn't hold it shared.
+*/
+// --------------------------------------------------------------------------------
+static NTreeSharedHold* FindSharedHold(const NTreeLock* inLock)
+{
+	size_t
+		i;
+
+	for (i = sSharedHolds.size(); i > 0; i -= 1)
+	{
+		if (sSharedHolds[i - 1].lock == inLock)
+		{
+			return &sSharedHolds[i - 1];
+		}
+	}
+
+	return nullptr;
+}
+
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeReadLock
+*/
+// --------------------------------------------------------------------------------
+NTreeReadLock::NTreeReadLock(NTreePtr inTree)
+{
+	fLock = ((inTree != nullptr) && inTree->IsThreadSafe()) ? &inTree->GetLock() : nullptr;
+	if (fLock != nullptr)
+	{
+		fLock->LockShared();
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeReadLock
+*/
+// --------------------------------------------------------------------------------
+NTreeReadLock::~NTreeReadLock()
+{
+	Release();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Release
+
+	Lets go of the lock before the lock object goes away.
+*/
+// --------------------------------------------------------------------------------
+void NTreeReadLock::Release(void)
+{
+	if (fLock != nullptr)
+	{
+		fLock->UnlockShared();
+		fLock = nullptr;
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeWriteLock
+*/
+// --------------------------------------------------------------------------------
+NTreeWriteLock::NTreeWriteLock(NTreePtr inTree)
+{
+	fLock = ((inTree != nullptr) && inTree->IsThreadSafe()) ? &inTree->GetLock() : nullptr;
+	fError = 0;
+	if (fLock != nullptr)
+	{
+		fError = fLock->Lock();
+		if (fError != 0)
+		{
+			fLock = nullptr;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeWriteLock
+*/
+// --------------------------------------------------------------------------------
+NTreeWriteLock::~NTreeWriteLock()
+{
+	if (fLock != nullptr)
+	{
+		fLock->Unlock();
+	}
+}
@@ -0,0 +1,156 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREELOCK_
+#define _NTREELOCK_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeLock.h
+
+		The lock of a thread-safe NTree (see NTree::SetThreadSafe): many threads
+		may read the tree at once, and one thread at a time may change it.
+
+		Readers take it shared, with an NTreeReadLock.  FindNodeByID, Freeze and
+		the VisitAllNTreeNodes traversals do so for you.  GetNumChildren and
+		GetChild don't, as they are on the traversals' hot path and a count is
+		stale by the time it is used anyway: hold an NTreeReadLock around any
+		query that reads children or keeps a node it found.
+
+		Writers take it exclusive, with an NTreeWriteLock.  InsertChild,
+		RemoveChild, Move, Prune and the other calls that change the tree do so
+		for you.  To make many changes, hold one NTreeWriteLock around all of
+		them: the calls inside don't lock again, and readers wait once instead of
+		once per change.
+
+		Write, WriteIndexed and WriteXML only read the tree, so they hold the
+		lock shared while they write.  Write and WriteIndexed then take it
+		exclusive just long enough to mark the tree clean; if a writer got in
+		between, the tree stops tracking changes until the next full save, as
+		what the file holds is no longer known.  WriteDelta marks nodes as it
+		goes and holds it exclusive, but only visits the changed nodes.
+		WriteAsync holds it exclusive only while it copies the tree.
+
+		CreateNode, DeleteNode, NewNodeID and the node accessors that set things
+		don't lock; they are for the writer, inside its NTreeWriteLock.
+
+		A writer waiting for the lock keeps new readers out, so a steady stream
+		of queries can't hold off an edit for long.
+
+		Both are re-entrant on the thread that holds them, and a thread holding
+		the lock exclusive may also read.  A thread holding it shared can't take
+		it exclusive, as two readers doing so would wait on each other forever;
+		the call that wanted to change the tree fails instead.  So a traversal
+		whose actions change the tree needs an NTreeWriteLock around it.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include "NTreeNode.h"
+
+class NTreeLock
+{
+public:
+
+	NTreeLock(void);
+	~NTreeLock();
+
+	void LockShared(void);
+	void UnlockShared(void);
+	long Lock(void);
+	void Unlock(void);
+
+	bool IsLockedByThisThread(void) const;
+	bool IsReadLockedByThisThread(void) const;
+	unsigned long GetWriteCount(void) const { return fWriteCount.load(); }
+
+private:
+
+	NTreeLock(const NTreeLock&);
+	NTreeLock& operator=(const NTreeLock&);
+
+	std::shared_timed_mutex fMutex;
+	std::atomic<unsigned long> fWritersWaiting;	// new readers wait until it is 0
+	std::mutex fGateMutex;
+	std::condition_variable fGate;			// notified when fWritersWaiting drops to 0
+	std::atomic<std::thread::id> fWriter;	// the thread holding it exclusive, if any
+	unsigned long fWriteDepth;				// times fWriter has locked it; only fWriter touches this
+	std::atomic<unsigned long> fWriteCount;	// times it has been held exclusive and let go
+};
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeReadLock
+
+	Holds inTree's lock shared for the life of the lock object.  Does nothing
+	if inTree is nullptr or not thread-safe.
+*/
+// --------------------------------------------------------------------------------
+class NTreeReadLock
+{
+public:
+
+	explicit NTreeReadLock(NTreePtr);
+	~NTreeReadLock();
+
+	void Release(void);
+
+private:
+
+	NTreeReadLock(const NTreeReadLock&);
+	NTreeReadLock& operator=(const NTreeReadLock&);
+
+	NTreeLock* fLock;
+};
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeWriteLock
+
+	Holds inTree's lock exclusive for the life of the lock object.  Does
+	nothing if inTree is nullptr or not thread-safe.  GetError() is non-zero
+	if the lock couldn't be taken, because this thread holds it shared.
+*/
+// --------------------------------------------------------------------------------
+class NTreeWriteLock
+{
+public:
+
+	explicit NTreeWriteLock(NTreePtr);
+	~NTreeWriteLock();
+
+	long GetError(void) const { return fError; }
+
+private:
+
+	NTreeWriteLock(const NTreeWriteLock&);
+	NTreeWriteLock& operator=(const NTreeWriteLock&);
+
+	NTreeLock* fLock;
+	long fError;
+};
+
+#endif
@@ -25,7 +25,13 @@
 #include "framework.h"
 
 #include "NTreeNode.h"
+#include "NTree.h"
+#include "NTreeCompact.h"
+#include "NTreeNodeFlags.h"
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <typeinfo>
 
 
 // ----- Constructors/Destructor -----
@@ -66,7 +72,7 @@ NTreeNode::NTreeNode
 
 	fType = inNode->GetType();
 	fID = inNodeID;
-	fFlags = inNode->GetFlags();
+	fFlags = short(inNode->GetFlags() & ~kNTreeNodeFlagDirty);
 	fParent = inNode->GetParent();
 	fNumChildren = inNode->GetNumChildren();
 }
@@ -80,12 +86,13 @@ NTreeNode::NTreeNode
 // --------------------------------------------------------------------------------
 NTreeNode::~NTreeNode()
 {
-	if (fChildren != nullptr)
+	if (fChildren != fInlineChildren)
 	{
 		free(fChildren);
-		fChildren = nullptr;
-		fNumChildren = 0;
 	}
+	fChildren = nullptr;
+	fNumChildren = 0;
+	fChildCapacity = 0;
 }
 
 
@@ -102,7 +109,10 @@ NTreeNode::Initialize(void)
 	fFlags = 0;
 	fParent = nullptr;
 	fNumChildren = 0;
-	fChildren = nullptr;
+	fChildCapacity = kNumInlineChildren;
+	fChildren = fInlineChildren;
+	fTree = nullptr;
+	fArena = nullptr;
 }
 
 // ----- Persistance -----
@@ -131,14 +141,26 @@ NTreeNode::Read
 		error = 0;
 	unsigned long
 		count;
-	short
+	NTreeChildIndex
 		i = 0;
 	NTreeNodeType
 		nodeType = 0;
 	NTreeNodePtr
 		child = nullptr;
-	short
-		numChildren = fNumChildren;
+	NTreeChildIndex
+		numChildren = 0;
+	NTreeNodeID
+		oldID = fID;
+	uint32_t
+		wideValue = 0;
+	unsigned short
+		narrowValue = 0;
+
+	if (static_cast<unsigned long>(inVersion) >= kNTreeVersion700)
+	{
+		error = ReadCompact(inFile, ioOffset, inReadCB);
+		goto ErrorExit;
+	}
 
 	count = sizeof(fType);
 	error = (*inReadCB)(inFile, &fType, count, 1, ioOffset);
@@ -146,11 +168,46 @@ NTreeNode::Read
 		goto ErrorExit;
 	ioOffset += count;
 
-	count = sizeof(fID);
-	error = (*inReadCB)(inFile, &fID, count, 1, ioOffset);
-	if (error != 0)
-		goto ErrorExit;
-	ioOffset += count;
+	/* Version 6 stores the ID and child count as 32 bits, older versions as 16 bits. */
+	if (static_cast<unsigned long>(inVersion) < kNTreeVersion600)
+	{
+		count = sizeof(narrowValue);
+		error = (*inReadCB)(inFile, &narrowValue, count, 1, ioOffset);
+		if (error != 0)
+			goto ErrorExit;
+		ioOffset += count;
+
+		/* The root's 16-bit ID maps to the root's ID in this build. */
+		fID = (narrowValue == 0xFFFF) ? kNTreeMaxNodeID : NTreeNodeID(narrowValue);
+	}
+	else
+	{
+		count = sizeof(wideValue);
+		error = (*inReadCB)(inFile, &wideValue, count, 1, ioOffset);
+		if (error != 0)
+			goto ErrorExit;
+		ioOffset += count;
+
+		if (wideValue == 0xFFFFFFFF)
+		{
+			fID = kNTreeMaxNodeID;
+		}
+		else if (wideValue < kNTreeMaxNodeID)
+		{
+			fID = NTreeNodeID(wideValue);
+		}
+		else
+		{
+			/* This build has no room for the ID; it needs NTREE_WIDE_IDS. */
+			error = -1;
+			goto ErrorExit;
+		}
+	}
+
+	if (fTree != nullptr)
+	{
+		fTree->NodeIDChanged(this, oldID);
+	}
 
 	count = sizeof(fFlags);
 	error = (*inReadCB)(inFile, &fFlags, count, 1, ioOffset);
@@ -158,12 +215,33 @@ NTreeNode::Read
 		goto ErrorExit;
 	ioOffset += count;
 
-	count = sizeof(fNumChildren);
-	error = (*inReadCB)(inFile, &fNumChildren, count, 1, ioOffset);
-	if (error != 0)
-		goto ErrorExit;
-	ioOffset += count;
+	fFlags &= ~kNTreeNodeFlagDirty;
+
+	if (static_cast<unsigned long>(inVersion) < kNTreeVersion600)
+	{
+		count = sizeof(narrowValue);
+		error = (*inReadCB)(inFile, &narrowValue, count, 1, ioOffset);
+		if (error != 0)
+			goto ErrorExit;
+		ioOffset += count;
+
+		wideValue = narrowValue;
+	}
+	else
+	{
+		count = sizeof(wideValue);
+		error = (*inReadCB)(inFile, &wideValue, count, 1, ioOffset);
+		if (error != 0)
+			goto ErrorExit;
+		ioOffset += count;
+	}
 
+	if (wideValue > uint32_t(kMaxChildren))
+	{
+		error = -1;
+		goto ErrorExit;
+	}
+	numChildren = NTreeChildIndex(wideValue);
 
 	fNumChildren = 0; // reset because, InsertChild will increment.
 	for (i = 0; i < numChildren; i += 1)
@@ -223,9 +301,18 @@ NTreeNode::Write
 {
 	long error = 0;
 	unsigned long count;
-	short i = 0;
+	NTreeChildIndex i = 0;
 	NTreeNodeType nodeType = 0;
+	uint32_t wideValue = 0;
+	unsigned short narrowValue = 0;
+	short flags = short(fFlags & ~kNTreeNodeFlagDirty);
+
 
+	if (static_cast<unsigned long>(inVersion) >= kNTreeVersion700)
+	{
+		error = WriteCompact(inFile, ioOffset, inWriteCB);
+		goto ErrorExit;
+	}
 
 	count = sizeof(fType);
 	error = (*inWriteCB)(inFile, &fType, count, 1, ioOffset);
@@ -233,20 +320,58 @@ NTreeNode::Write
 		goto ErrorExit;
 	ioOffset += count;
 
-	count = sizeof(fID);
-	error = (*inWriteCB)(inFile, &fID, count, 1, ioOffset);
+	/* Version 6 stores the ID and child count as 32 bits, older versions as 16 bits. */
+	if (static_cast<unsigned long>(inVersion) < kNTreeVersion600)
+	{
+		if ((fID != kNTreeMaxNodeID) && (fID >= 0xFFFF))
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+		narrowValue = (fID == kNTreeMaxNodeID) ? 0xFFFF : static_cast<unsigned short>(fID);
+
+		count = sizeof(narrowValue);
+		error = (*inWriteCB)(inFile, &narrowValue, count, 1, ioOffset);
+	}
+	else
+	{
+		wideValue = (fID == kNTreeMaxNodeID) ? 0xFFFFFFFF : uint32_t(fID);
+
+		count = sizeof(wideValue);
+		error = (*inWriteCB)(inFile, &wideValue, count, 1, ioOffset);
+	}
 	if (error != 0)
 		goto ErrorExit;
 	ioOffset += count;
 
-	count = sizeof(fFlags);
-	error = (*inWriteCB)(inFile, &fFlags, count, 1, ioOffset);
+	count = sizeof(flags);
+	error = (*inWriteCB)(inFile, &flags, count, 1, ioOffset);
 	if (error != 0)
 		goto ErrorExit;
 	ioOffset += count;
 
-	count = sizeof(fNumChildren);
-	error = (*inWriteCB)(inFile, &fNumChildren, count, 1, ioOffset);
+	if (static_cast<unsigned long>(inVersion) < kNTreeVersion600)
+	{
+#if defined(NTREE_WIDE_IDS)
+		/* Only a wide build can have more children than version 5 stores. */
+		if (fNumChildren > 0x7FFF)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+#endif
+		narrowValue = static_cast<unsigned short>(fNumChildren);
+
+		count = sizeof(narrowValue);
+		error = (*inWriteCB)(inFile, &narrowValue, count, 1, ioOffset);
+	}
+	else
+	{
+		wideValue = uint32_t(fNumChildren);
+
+		count = sizeof(wideValue);
+		error = (*inWriteCB)(inFile, &wideValue, count, 1, ioOffset);
+	}
 	if (error != 0)
 		goto ErrorExit;
 	ioOffset += count;
@@ -254,7 +379,8 @@ NTreeNode::Write
 	/* Write out child types */
 	for (i = 0; i < fNumChildren; i += 1)
 	{
-		nodeType = GetChild(i)->GetType();
+		/* Not the virtual GetChild; a paged root would read every branch in for its type. */
+		nodeType = NTreeNode::GetChild(i)->GetType();
 
 		count = sizeof(nodeType);
 		error = (*inWriteCB)(inFile, &nodeType, count, 1, ioOffset);
@@ -271,49 +397,302 @@ ErrorExit:
 	return (error);
 }
 
+// --------------------------------------------------------------------------------
+/*
+	CloneForWrite
+
+	Returns a node, outside any tree and without children, that NTree::WriteAsync
+	writes at inVersion in this one's place, on another thread, while this one
+	may be changed.  A plain NTreeNode is copied.  The data of a subclass is
+	known only to its Write, so its record is written into memory now and kept
+	(see NTreeRecordCopy); subclasses whose data is cheap to copy override this
+	to copy the node instead, setting the type, ID and flags too.
+
+	Returns nullptr if an error occurred.
+*/
+// --------------------------------------------------------------------------------
+NTreeNodePtr
+NTreeNode::CloneForWrite(long inVersion)
+{
+	NTreeNodePtr
+		copy = nullptr;
+	NTreeRecordCopy<NTreeNode>*
+		record = nullptr;
+
+	if (typeid(*this) != typeid(NTreeNode))
+	{
+		record = new NTreeRecordCopy<NTreeNode>;
+		if (record->Capture(this, inVersion) != 0)
+		{
+			delete record;
+			record = nullptr;
+		}
+		return record;
+	}
+
+	copy = new NTreeNode(fType, fID);
+	copy->fFlags = short(fFlags & ~kNTreeNodeFlagDirty);
+
+	return copy;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadCompact
+
+	Reads the rest of a version 7 record, after the type, which NTree has read.
+	The child count is set, with nullptr in every slot for NTree to fill, so
+	the parent must already be set for the ID to come out right.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::ReadCompact
+(
+	void* inFile,
+	long& ioOffset,
+	NTreeNodeReadCB inReadCB
+)
+{
+	long
+		error = 0;
+	uint64_t
+		value = 0;
+	int64_t
+		id = 0;
+	NTreeNodeID
+		oldID = fID;
+
+	/* 0 is the root; anything else is one more than the zigzagged difference from the base. */
+	error = NTreeReadVarint(inFile, inReadCB, ioOffset, value);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	if (value == 0)
+	{
+		fID = kNTreeMaxNodeID;
+	}
+	else
+	{
+		id = int64_t(GetCompactIDBase()) + NTreeUnZigZag(value - 1);
+		if ((id < int64_t(kUnassignedID)) || (id >= int64_t(kNTreeMaxNodeID)))
+		{
+			error = -1;
+			goto ErrorExit;
+		}
+		fID = NTreeNodeID(id);
+	}
+
+	if (fTree != nullptr)
+	{
+		fTree->NodeIDChanged(this, oldID);
+	}
+
+	error = NTreeReadVarint(inFile, inReadCB, ioOffset, value);
+	if ((error == 0) && (value > 0xFFFF))
+	{
+		error = -1;
+	}
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+	fFlags = short(uint16_t(value) & ~kNTreeNodeFlagDirty);
+
+	error = NTreeReadVarint(inFile, inReadCB, ioOffset, value);
+	if ((error == 0) && (value > uint64_t(kMaxChildren)))
+	{
+		error = -1;
+	}
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	fNumChildren = 0;
+	error = MoreChildren(NTreeChildIndex(value));
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	WriteCompact
+
+	Writes a version 7 record, all but the type, in one call to inWriteCB.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::WriteCompact
+(
+	void* inFile,
+	long& ioOffset,
+	NTreeNodeWriteCB inWriteCB
+)
+{
+	long
+		error = 0;
+	unsigned char
+		bytes[3 * kNTreeMaxVarintSize];
+	size_t
+		count = 0;
+	uint64_t
+		idCode = 0;
+
+	if (fID != kNTreeMaxNodeID)
+	{
+		idCode = NTreeZigZag(int64_t(fID) - int64_t(GetCompactIDBase())) + 1;
+	}
+
+	count += NTreeEncodeVarint(idCode, bytes + count);
+	count += NTreeEncodeVarint(uint16_t(fFlags & ~kNTreeNodeFlagDirty), bytes + count);
+	count += NTreeEncodeVarint(uint64_t(fNumChildren), bytes + count);
+
+	error = (*inWriteCB)(inFile, bytes, static_cast<unsigned long>(count), 1, ioOffset);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+	ioOffset += long(count);
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	WriteXMLAttributes
+
+	Pushes the node's ID, and its flags if it has any, as attributes of the
+	element NTree::WriteXML has just opened for it.  Subclasses that keep data
+	of their own override this, call it, and push theirs after.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::WriteXMLAttributes(tinyxml2::XMLPrinter& inPrinter)
+{
+	short
+		flags = short(fFlags & ~kNTreeNodeFlagDirty);
+
+	inPrinter.PushAttribute("id", unsigned(fID));
+	if (flags != 0)
+	{
+		inPrinter.PushAttribute("flags", int(flags));
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadXMLAttributes
+
+	Reads back the flags WriteXMLAttributes pushed.  The ID was given to the
+	function that made the node.  Subclasses that override WriteXMLAttributes
+	override this too, call it, and read theirs after.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::ReadXMLAttributes(const tinyxml2::XMLElement* inElement)
+{
+	int
+		flags = 0;
+
+	if (inElement->QueryIntAttribute("flags", &flags) == tinyxml2::XML_NO_ERROR)
+	{
+		fFlags = short(uint16_t(flags) & ~kNTreeNodeFlagDirty);
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	GetCompactIDBase
+
+	What a version 7 record's ID is stored relative to: the parent's ID, as
+	children are usually made soon after their parents, or 0 under the root
+	or with no parent.
+*/
+// --------------------------------------------------------------------------------
+NTreeNodeID
+NTreeNode::GetCompactIDBase(void)
+{
+	NTreeNodeID
+		base = kUnassignedID;
+
+	if ((fParent != nullptr) && (fParent->GetID() != kNTreeMaxNodeID))
+	{
+		base = fParent->GetID();
+	}
+
+	return base;
+}
+
 // ----- Children -----
 
 // --------------------------------------------------------------------------------
 /*
 	MoreChildren
 
-	Increases the child array by inNumChildrenToAdd.  If the child array cannot
-	be grown, an error is returned.
+	Increases the child count by inNumChildrenToAdd.  The new slots are set to
+	nullptr.  The child array only grows when the count passes its capacity, and
+	then it doubles, so appending children is amortized constant time.  If the
+	child array cannot be grown, an error is returned.
 */
 // --------------------------------------------------------------------------------
 long
-NTreeNode::MoreChildren(short inNumChildrenToAdd)
+NTreeNode::MoreChildren(NTreeChildIndex inNumChildrenToAdd)
 {
 	long
 		error = 0;
-	NTreeNodePtr*
-		newArray = nullptr;
+	NTreeChildIndex
+		numChildren = 0;
+	NTreeChildIndex
+		i;
 
-	/* Create a new, larger array. */
-	newArray = static_cast<NTreeNodePtr*>(calloc(fNumChildren + inNumChildrenToAdd, sizeof(NTreeNodePtr)));
-	if (newArray == nullptr)
+	if ((inNumChildrenToAdd < 0) || (inNumChildrenToAdd > kMaxChildren - fNumChildren))
 	{
 		error = -1;
 		goto ErrorExit;
 	}
 
-	/* If we have children, copy them over. */
-	if (fNumChildren > 0)
+	numChildren = fNumChildren + inNumChildrenToAdd;
+
+	/* Grow geometrically if we have run out of room. */
+	if (numChildren > fChildCapacity)
 	{
-		short
-			i;
+		NTreeChildIndex
+			capacity = (fChildCapacity > 0) ? fChildCapacity : NTreeChildIndex(kMinChildCapacity);
 
-		for (i = 0; i < fNumChildren; i += 1)
+		while (capacity < numChildren)
 		{
-			*(newArray + i) = *(fChildren + i);
+			capacity = (capacity > kMaxChildren / 2) ? NTreeChildIndex(kMaxChildren) : capacity * 2;
+		}
+
+		error = ReserveChildren(capacity);
+		if (error != 0)
+		{
+			goto ErrorExit;
 		}
-		free(fChildren);
-		fChildren = nullptr;
 	}
 
-	/* Assign our new array */
-	fChildren = newArray;
-	fNumChildren += inNumChildrenToAdd;
+	for (i = fNumChildren; i < numChildren; i += 1)
+	{
+		*(fChildren + i) = nullptr;
+	}
+
+	fNumChildren = numChildren;
 
 ErrorExit:
 	return error;
@@ -323,11 +702,12 @@ ErrorExit:
 /*
 	LessChildren
 
-	Reduces the child array by inNumChildrenToReduce.  Returns 0 if no error.
+	Reduces the child count by inNumChildrenToReduce.  The child array keeps its
+	capacity; call ShrinkChildren to give the memory back.  Returns 0 if no error.
 */
 // --------------------------------------------------------------------------------
 long
-NTreeNode::LessChildren(short inNumChildrenToReduce)
+NTreeNode::LessChildren(NTreeChildIndex inNumChildrenToReduce)
 {
 	long
 		error = 0;
@@ -335,46 +715,124 @@ NTreeNode::LessChildren(short inNumChildrenToReduce)
 
 	if (fNumChildren > 0)
 	{
-		short
+		NTreeChildIndex
 			numChildren = fNumChildren - inNumChildrenToReduce;
 
-		if (numChildren <= 0)
+		fNumChildren = (numChildren <= 0) ? 0 : numChildren;
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReserveChildren
+
+	Makes sure the child array can hold at least inCapacity children without being
+	reallocated.  The child count is not changed.  The first time the count outgrows
+	the inline buffer, the children are moved to the heap.  Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::ReserveChildren(NTreeChildIndex inCapacity)
+{
+	NTreeWriteLock
+		lock(fTree);
+	long
+		error = lock.GetError();
+	NTreeNodePtr*
+		newArray = nullptr;
+
+	if ((error == 0) && (inCapacity > fChildCapacity))
+	{
+		if (fChildren == fInlineChildren)
 		{
-			if (fChildren != nullptr)
+			newArray = static_cast<NTreeNodePtr*>(malloc(inCapacity * sizeof(NTreeNodePtr)));
+			if (newArray != nullptr)
 			{
-				free(fChildren);
+				memcpy(newArray, fInlineChildren, fNumChildren * sizeof(NTreeNodePtr));
 			}
-			fChildren = nullptr;
-			fNumChildren = 0;
 		}
 		else
 		{
-			short i;
-			NTreeNodePtr* newArray = nullptr;
+			newArray = static_cast<NTreeNodePtr*>(realloc(fChildren, inCapacity * sizeof(NTreeNodePtr)));
+		}
 
-			newArray = static_cast<NTreeNodePtr*>(malloc(numChildren * sizeof(NTreeNodePtr)));
-			if (newArray == nullptr)
-			{
-				error = -1;
-				goto ErrorExit;
-			}
+		if (newArray == nullptr)
+		{
+			error = -1;
+			goto ErrorExit;
+		}
 
-			for (i = 0; i < numChildren; i += 1)
-			{
-				*(newArray + i) = *(fChildren + i);
-			}
-			free(fChildren);
-			fChildren = nullptr;
+		fChildren = newArray;
+		fChildCapacity = inCapacity;
+	}
+
+ErrorExit:
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ShrinkChildren
+
+	Releases any unused capacity in the child array.  If the children fit in the
+	inline buffer again, the heap block is freed.  Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::ShrinkChildren(void)
+{
+	NTreeWriteLock
+		lock(fTree);
+	long
+		error = lock.GetError();
+
+	if (error != 0)
+	{
+		/* This thread is only reading the tree. */
+	}
+	else if (fChildren == fInlineChildren)
+	{
+		/* Nothing to give back. */
+	}
+	else if (fNumChildren <= kNumInlineChildren)
+	{
+		memcpy(fInlineChildren, fChildren, fNumChildren * sizeof(NTreeNodePtr));
+		free(fChildren);
+		fChildren = fInlineChildren;
+		fChildCapacity = kNumInlineChildren;
+	}
+	else if (fChildCapacity > fNumChildren)
+	{
+		NTreeNodePtr*
+			newArray = static_cast<NTreeNodePtr*>(realloc(fChildren, fNumChildren * sizeof(NTreeNodePtr)));
 
+		/* If the allocator can't give us a smaller block, the old one is still good. */
+		if (newArray != nullptr)
+		{
 			fChildren = newArray;
-			fNumChildren = numChildren;
+			fChildCapacity = fNumChildren;
 		}
 	}
 
-ErrorExit:
 	return error;
 }
 
+// --------------------------------------------------------------------------------
+/*
+	GetChildCapacity
+
+	Returns the number of children the node can hold before the child array has
+	to grow.
+*/
+// --------------------------------------------------------------------------------
+NTreeChildIndex
+NTreeNode::GetChildCapacity(void)
+{
+	return fChildCapacity;
+}
+
 // --------------------------------------------------------------------------------
 /*
 	InsertChild
@@ -393,6 +851,7 @@ NTreeNode::InsertChild(NTreeNodePtr inNewChild)
 	InsertChild
 
 	Insert child into child array at inAtIndex.  To append, use method above.
+	If this node belongs to a tree, the child and its descendants join it.
 */
 // --------------------------------------------------------------------------------
 long
@@ -400,7 +859,50 @@ NTreeNode::InsertChild
 (
 	NTreeNodePtr
 	inNewChild,
-	short
+	NTreeChildIndex
+	inAtIndex
+)
+{
+	NTreeWriteLock
+		lock(fTree);
+	long
+		error = lock.GetError();
+
+
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	error = InsertChildEntry(inNewChild, inAtIndex);
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	if (fTree != nullptr)
+	{
+		fTree->AttachNodes(inNewChild);
+	}
+
+ErrorExit:
+	return (error);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	InsertChildEntry
+
+	Puts the child into the child array at inAtIndex and points it at this node,
+	without telling the tree.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::InsertChildEntry
+(
+	NTreeNodePtr
+	inNewChild,
+	NTreeChildIndex
 	inAtIndex
 )
 {
@@ -424,7 +926,7 @@ NTreeNode::InsertChild
 	}
 	else
 	{
-		short
+		NTreeChildIndex
 			i;
 
 		for (i = fNumChildren - 1; i > inAtIndex; i -= 1)
@@ -438,6 +940,8 @@ NTreeNode::InsertChild
 	// Point the child at new parent.
 	inNewChild->SetParent(this);
 
+	MarkDirty();
+
 ErrorExit:
 	return (error);
 }
@@ -447,11 +951,43 @@ ErrorExit:
 	RemoveChild
 
 	Remove the child inChild from the child array.  This routine DOES NOT delete
-	the child that is removed.
+	the child that is removed.  The child and its descendants leave the tree.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeNode::RemoveChild(NTreeChildIndex inChildIndex)
+{
+	NTreeWriteLock
+		lock(fTree);
+	long
+		error = lock.GetError();
+	NTreeNodePtr
+		child = nullptr;
+
+
+	if ((error == 0) && (inChildIndex >= 0) && (inChildIndex < fNumChildren))
+	{
+		child = GetChild(inChildIndex);
+
+		error = RemoveChildEntry(inChildIndex);
+		if ((error == 0) && (fTree != nullptr))
+		{
+			fTree->DetachNodes(child);
+		}
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	RemoveChildEntry
+
+	Takes the child out of the child array without telling the tree.
 */
 // --------------------------------------------------------------------------------
 long
-NTreeNode::RemoveChild(short inChildIndex)
+NTreeNode::RemoveChildEntry(NTreeChildIndex inChildIndex)
 {
 	long
 		error = 0;
@@ -465,7 +1001,7 @@ NTreeNode::RemoveChild(short inChildIndex)
 		}
 		else
 		{
-			short
+			NTreeChildIndex
 				i;
 
 			for (i = inChildIndex; i < fNumChildren - 1; i += 1)
@@ -475,6 +1011,8 @@ NTreeNode::RemoveChild(short inChildIndex)
 
 			LessChildren(1);
 		}
+
+		MarkDirty();
 	}
 
 	return error;
@@ -499,7 +1037,8 @@ NTreeNode::RemoveChild(NTreeNodePtr inChild)
 /*
 	Move
 
-	Move this node elsewhere - given by inNewParent and index.
+	Move this node elsewhere - given by inNewParent and index.  A move within
+	the same tree leaves the tree's ID table alone.
 */
 // --------------------------------------------------------------------------------
 long
@@ -507,17 +1046,34 @@ NTreeNode::Move
 (
 	NTreeNodePtr
 	inNewParent,
-	short
+	NTreeChildIndex
 	inIndex
 )
 {
+	NTreeWriteLock
+		lock(fTree);
 	long
-		error = 0;
+		error = lock.GetError();
 	NTreeNodePtr
 		parent = GetParent();
 
 
-	if (parent != nullptr)
+	if (error != 0)
+	{
+		goto ErrorExit;
+	}
+
+	if ((parent != nullptr) && (fTree != nullptr) && (inNewParent->GetTree() == fTree))
+	{
+		error = parent->RemoveChildEntry(parent->FindChildIndexByAddress(this));
+		if (error != 0)
+		{
+			goto ErrorExit;
+		}
+
+		error = inNewParent->InsertChildEntry(this, inIndex);
+	}
+	else if (parent != nullptr)
 	{
 		/* Remove this node from current parent */
 		error = GetParent()->RemoveChild(this);
@@ -556,6 +1112,7 @@ void
 NTreeNode::SetType(NTreeNodeType inType)
 {
 	fType = inType;
+	MarkDirty();
 }
 
 // --------------------------------------------------------------------------------
@@ -572,12 +1129,28 @@ NTreeNode::GetID(void)
 // --------------------------------------------------------------------------------
 /*
 	SetID
+
+	The parent changes too, since a delta lists each node's children by ID.
 */
 // --------------------------------------------------------------------------------
 void
 NTreeNode::SetID(NTreeNodeID inID)
 {
+	NTreeNodeID
+		oldID = fID;
+
 	fID = inID;
+
+	if (fTree != nullptr)
+	{
+		fTree->NodeIDChanged(this, oldID);
+	}
+
+	MarkDirty();
+	if (fParent != nullptr)
+	{
+		fParent->MarkDirty();
+	}
 }
 
 // --------------------------------------------------------------------------------
@@ -597,13 +1170,20 @@ NTreeNode::GetFlags(void)
 /*
 	SetFlags
 
-	Sets the nodes flags.
+	Sets the nodes flags.  kNTreeNodeFlagDirty is kept as it is.
 */
 // --------------------------------------------------------------------------------
 void
 NTreeNode::SetFlags(short inFlags)
 {
-	fFlags = inFlags;
+	short
+		flags = short((inFlags & ~kNTreeNodeFlagDirty) | (fFlags & kNTreeNodeFlagDirty));
+
+	if (flags != fFlags)
+	{
+		fFlags = flags;
+		MarkDirty();
+	}
 }
 
 
@@ -640,7 +1220,7 @@ NTreeNode::SetParent(NTreeNodePtr inParent)
 	Returns the node's number of children.
 */
 // --------------------------------------------------------------------------------
-short
+NTreeChildIndex
 NTreeNode::GetNumChildren(void)
 {
 	return fNumChildren;
@@ -650,24 +1230,33 @@ NTreeNode::GetNumChildren(void)
 /*
 	SetNumChildren
 
-	Sets the number of children in a node.
+	Sets the number of children in a node.  Growing the count adds empty (nullptr)
+	slots to the end of the child array.
 */
 // --------------------------------------------------------------------------------
 void
-NTreeNode::SetNumChildren(short inNumChildren)
+NTreeNode::SetNumChildren(NTreeChildIndex inNumChildren)
 {
-	fNumChildren = inNumChildren;
+	if (inNumChildren > fNumChildren)
+	{
+		MoreChildren(inNumChildren - fNumChildren);
+	}
+	else
+	{
+		fNumChildren = inNumChildren;
+	}
 }
 
 // --------------------------------------------------------------------------------
 /*
 	GetChild
 
-	Returns the child node at the given index.
+	Returns the child node at the given index.  On a thread-safe tree, hold an
+	NTreeReadLock while reading the children (traversals hold it already).
 */
 // --------------------------------------------------------------------------------
 NTreeNodePtr
-NTreeNode::GetChild(short inChildIndex)
+NTreeNode::GetChild(NTreeChildIndex inChildIndex)
 {
 	return *(fChildren + inChildIndex);
 }
@@ -682,7 +1271,7 @@ NTreeNode::GetChild(short inChildIndex)
 void
 NTreeNode::SetChild
 (
-	short
+	NTreeChildIndex
 	inChildIndex,
 	NTreeNodePtr
 	inChild
@@ -691,6 +1280,101 @@ NTreeNode::SetChild
 	*(fChildren + inChildIndex) = inChild;
 }
 
+// --------------------------------------------------------------------------------
+/*
+	GetTree
+
+	Returns the tree this node is in, or nullptr if it is not in one.
+*/
+// --------------------------------------------------------------------------------
+NTreePtr
+NTreeNode::GetTree(void) const
+{
+	return fTree;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	MarkDirty
+
+	Notes that the node has changed since its tree was last saved, so that the
+	next NTree::WriteDelta writes it.  Does nothing unless the node is in a tree
+	that tracks changes.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeNode::MarkDirty(void)
+{
+	if ((fTree != nullptr) && fTree->IsTrackingChanges() && ((fFlags & kNTreeNodeFlagDirty) == 0))
+	{
+		fFlags |= kNTreeNodeFlagDirty;
+		fTree->NodeChanged(this);
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	MarkClean
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeNode::MarkClean(void)
+{
+	fFlags &= ~kNTreeNodeFlagDirty;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	IsDirty
+*/
+// --------------------------------------------------------------------------------
+bool
+NTreeNode::IsDirty(void) const
+{
+	return (fFlags & kNTreeNodeFlagDirty) != 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	SetTree
+
+	Sets the tree this node is in.  Normally only called by NTree.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeNode::SetTree(NTreePtr inTree)
+{
+	fTree = inTree;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	GetArena
+
+	Returns the arena this node's memory came from, or nullptr if the node was
+	made with new.
+*/
+// --------------------------------------------------------------------------------
+NTreeNodeArenaPtr
+NTreeNode::GetArena(void) const
+{
+	return fArena;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	SetArena
+
+	Records the arena this node's memory came from.  Only called by
+	NTree::CreateNode.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeNode::SetArena(NTreeNodeArenaPtr inArena)
+{
+	fArena = inArena;
+}
+
 // ----- Utilities -----
 
 // --------------------------------------------------------------------------------
@@ -720,14 +1404,14 @@ NTreeNode::FindChildIndexByData( void * inData )
 	found, return -1
 */
 // --------------------------------------------------------------------------------
-short NTreeNode::FindChildIndexByAddress(NTreeNodePtr inChild)
+NTreeChildIndex NTreeNode::FindChildIndexByAddress(NTreeNodePtr inChild)
 {
-	short
+	NTreeChildIndex
 		index = -1;
 
 	if (fNumChildren > 0)
 	{
-		short
+		NTreeChildIndex
 			i = 0;
 
 		while ((i < fNumChildren) && (*(fChildren + i) != inChild))
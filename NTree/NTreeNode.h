@@ -35,6 +35,10 @@
 		of pointers to children.  There is a pointer to data in which to hang
 		application specific data.
 
+		Most nodes have only a few children, so the first kNumInlineChildren child
+		pointers are stored inside the node itself.  The array moves to the heap
+		only when it outgrows that buffer.
+
 		See NTree.h for more information about NTrees.
 */
 //--------------------------------------------------------------------------------
@@ -70,18 +74,54 @@
 	*/
 
 	/* DCC - 18 DEC 07 - Up'd the version for 5.0 release. */
-const unsigned long kNTreeVersion = 0x00000500;	/* version 5.0.0 */
+const unsigned long kNTreeVersion500 = 0x00000500;	/* version 5.0.0 */
+
+	/* Up'd the version for 32-bit node IDs and child counts.  Version 6 files always store
+		both as 32 bits, whichever way NTree was built; version 5 files store them as 16 bits. */
+const unsigned long kNTreeVersion600 = 0x00000600;	/* version 6.0.0 */
+
+	/* Up'd the version for the compact format (see NTreeCompact.h).  A version 7 node
+		record is its ID, as a varint of the difference from its parent's ID, then its
+		flags and child count as varints.  Node types are written by NTree, as indexes
+		into a dictionary in front of the tree, and the child types are left out: Read
+		makes room for the children, and NTree makes and reads them in turn. */
+const unsigned long kNTreeVersion700 = 0x00000700;	/* version 7.0.0 */
+
+	/* The latest version.  Code that handles a format checks for its own constant
+		above, so that a later version doesn't silently change what it reads. */
+const unsigned long kNTreeVersion = kNTreeVersion700;
 
 	/* Each node is assigned a unique id.  This is usually just an incremented number
-		each time a node is created. */
+		each time a node is created.
+
+		By default node IDs are 16 bits and a node may have up to 32,767 children.  Define
+		NTREE_WIDE_IDS when building NTree (and everything that includes it) for 32-bit IDs
+		and child counts, for trees of more than 65,534 nodes. */
 typedef unsigned int NTreeNodeType;
+#if defined(NTREE_WIDE_IDS)
+typedef unsigned int NTreeNodeID;
+typedef int NTreeChildIndex;
+const NTreeChildIndex kNTreeMaxChildren = 0x7FFFFFFF;
+#else
 typedef unsigned short NTreeNodeID;
+typedef short NTreeChildIndex;
+const NTreeChildIndex kNTreeMaxChildren = 0x7FFF;
+#endif
+
+	/* The largest node ID.  It is reserved for the root. */
+const NTreeNodeID kNTreeMaxNodeID = NTreeNodeID(~0u);
 
 class NTreeNode;
 #define Node NTreeNode
 
 typedef class NTreeNode* NTreeNodePtr;
 
+class NTree;
+typedef class NTree* NTreePtr;
+
+class NTreeNodeArena;
+typedef class NTreeNodeArena* NTreeNodeArenaPtr;
+
 /* These two functions call platform specific functions that actually do the file i/o. */
 typedef long (*NTreeNodeReadCB)(void*, void*, unsigned long, unsigned long, long);
 typedef long (*NTreeNodeWriteCB)(void*, void*, unsigned long, unsigned long, long);
@@ -95,7 +135,10 @@ public:
 	enum
 	{
 		kVisited = (1 << 1),
-		kUnassignedID = 0
+		kUnassignedID = 0,
+		kNumInlineChildren = 4,
+		kMinChildCapacity = 4,
+		kMaxChildren = kNTreeMaxChildren
 	};
 
 
@@ -111,16 +154,27 @@ public:
 	virtual long Read(void*, long&, long, NTreeNodeReanimateFunc, NTreeNodeReadCB);
 	virtual long Write(void*, long&, long, NTreeNodeWriteCB);
 
+	/* Called by NTree::WriteAsync: a copy, outside any tree, to be written in this node's place. */
+	virtual NTreeNodePtr CloneForWrite(long);
+
+	/* Called by NTree::WriteXML with the node's element just opened; push its attributes. */
+	virtual long WriteXMLAttributes(tinyxml2::XMLPrinter&);
+	/* Called by NTree::ReadXML for nodes made through its NTreeXMLTypeTable; read them back. */
+	virtual long ReadXMLAttributes(const tinyxml2::XMLElement*);
+
 
 	/* Children */
-	virtual short GetNumChildren(void);
-	virtual void SetNumChildren(short);
+	virtual NTreeChildIndex GetNumChildren(void);
+	virtual void SetNumChildren(NTreeChildIndex);
 	virtual long InsertChild(NTreeNodePtr);
-	virtual long InsertChild(NTreeNodePtr, short);
+	virtual long InsertChild(NTreeNodePtr, NTreeChildIndex);
 	virtual long RemoveChild(NTreeNodePtr);
-	virtual long RemoveChild(short);
-	virtual NTreeNodePtr GetChild(short);
-	virtual void SetChild(short, NTreeNodePtr);
+	virtual long RemoveChild(NTreeChildIndex);
+	virtual NTreeNodePtr GetChild(NTreeChildIndex);
+	virtual void SetChild(NTreeChildIndex, NTreeNodePtr);
+	virtual long ReserveChildren(NTreeChildIndex);
+	virtual long ShrinkChildren(void);
+	virtual NTreeChildIndex GetChildCapacity(void);
 
 	/* Accessors */
 	virtual NTreeNodeType GetType(void);
@@ -131,26 +185,49 @@ public:
 	virtual void SetFlags(short);
 	virtual NTreeNodePtr GetParent(void);
 	virtual void SetParent(NTreeNodePtr);
+	NTreePtr GetTree(void) const;
+	void SetTree(NTreePtr);
+	NTreeNodeArenaPtr GetArena(void) const;
+	void SetArena(NTreeNodeArenaPtr);
 
 	/* Utilities */
-	virtual long Move(NTreeNodePtr, short);
-	virtual short FindChildIndexByAddress(NTreeNodePtr);
+	virtual long Move(NTreeNodePtr, NTreeChildIndex);
+	virtual NTreeChildIndex FindChildIndexByAddress(NTreeNodePtr);
 	virtual bool IsRoot();
 
+	/* Change tracking, for NTree::WriteDelta.  Call MarkDirty after changing data a
+		subclass reads and writes itself; the accessors above call it for you. */
+	void MarkDirty(void);
+	void MarkClean(void);
+	bool IsDirty(void) const;
+
 protected:
 
 	void Initialize(void);
-	long MoreChildren(short);
-	long LessChildren(short);
+	long MoreChildren(NTreeChildIndex);
+	long LessChildren(NTreeChildIndex);
+	long InsertChildEntry(NTreeNodePtr, NTreeChildIndex);
+	long RemoveChildEntry(NTreeChildIndex);
+	long ReadCompact(void*, long&, NTreeNodeReadCB);
+	long WriteCompact(void*, long&, NTreeNodeWriteCB);
+	NTreeNodeID GetCompactIDBase(void);
 
 private:
 
+	/* fChildren may point into the node itself, so nodes can't be copied. */
+	NTreeNode(const NTreeNode&);
+	NTreeNode& operator=(const NTreeNode&);
+
 	NTreeNodeType fType;			// node type
 	NTreeNodeID fID;			    // node id
 	short fFlags;					// defined in NTreeNodeFlags.h
 	NTreeNodePtr fParent;			// parent
-	short fNumChildren;				// number of entries in the children array
+	NTreePtr fTree;					// tree this node is in, nullptr if none
+	NTreeNodeArenaPtr fArena;		// arena holding this node, nullptr if it was new'd
+	NTreeChildIndex fNumChildren;	// number of entries in the children array
+	NTreeChildIndex fChildCapacity;	// number of slots allocated in the children array
 	NTreeNodePtr* fChildren;        // Handle to block containing an array of NodePtr
+	NTreeNodePtr fInlineChildren[kNumInlineChildren];	// children live here until they outgrow it
 };
 
 
@@ -0,0 +1,179 @@
+// --------------------------------------------------------------------------------
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeNodeArena.h"
+#include <cstdlib>
+
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeNodeArena
+*/
+// --------------------------------------------------------------------------------
+NTreeNodeArena::NTreeNodeArena(void)
+{
+	fNext = nullptr;
+	fEnd = nullptr;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeNodeArena
+
+	Frees the slabs.  Any node still in them must already have been destroyed.
+*/
+// --------------------------------------------------------------------------------
+NTreeNodeArena::~NTreeNodeArena()
+{
+	ReleaseAll();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Allocate
+
+	Returns a block of at least inSize bytes, or nullptr if out of memory.  A
+	block of the same size given back with Free() is reused first; otherwise the
+	block is cut from the current slab.  Blocks too big for a slab get a slab of
+	their own.
+*/
+// --------------------------------------------------------------------------------
+void*
+NTreeNodeArena::Allocate(size_t inSize)
+{
+	size_t
+		size = (inSize > sizeof(FreeBlock)) ? inSize : sizeof(FreeBlock);
+	size_t
+		sizeClass = 0;
+	size_t
+		blockSize = 0;
+	char*
+		block = nullptr;
+
+	size = (size + kAlignment - 1) & ~size_t(kAlignment - 1);
+	sizeClass = size / kAlignment;
+	blockSize = kHeaderSize + size;
+
+	if ((sizeClass < fFreeLists.size()) && (fFreeLists[sizeClass] != nullptr))
+	{
+		FreeBlock*
+			freeBlock = fFreeLists[sizeClass];
+
+		fFreeLists[sizeClass] = freeBlock->next;
+		return freeBlock;
+	}
+
+	if (blockSize > size_t(fEnd - fNext))
+	{
+		size_t
+			slabSize = (blockSize > kSlabSize / 4) ? blockSize : size_t(kSlabSize);
+		char*
+			slab = static_cast<char*>(malloc(slabSize));
+
+		if (slab == nullptr)
+		{
+			goto ErrorExit;
+		}
+
+		fSlabs.push_back(slab);
+
+		if (slabSize != size_t(kSlabSize))
+		{
+			/* A slab of its own; the current slab keeps its room. */
+			block = slab;
+		}
+		else
+		{
+			fNext = slab;
+			fEnd = slab + slabSize;
+		}
+	}
+
+	if (block == nullptr)
+	{
+		block = fNext;
+		fNext += blockSize;
+	}
+
+	*reinterpret_cast<size_t*>(block) = size;
+	return block + kHeaderSize;
+
+ErrorExit:
+	return nullptr;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Free
+
+	Gives back a block returned by Allocate().  It goes on the list for its size
+	and is handed out again by the next Allocate() of that size.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeNodeArena::Free(void* inBlock)
+{
+	if (inBlock != nullptr)
+	{
+		size_t
+			sizeClass = *reinterpret_cast<size_t*>(static_cast<char*>(inBlock) - kHeaderSize) / kAlignment;
+		FreeBlock*
+			freeBlock = static_cast<FreeBlock*>(inBlock);
+
+		if (sizeClass >= fFreeLists.size())
+		{
+			fFreeLists.resize(sizeClass + 1, nullptr);
+		}
+
+		freeBlock->next = fFreeLists[sizeClass];
+		fFreeLists[sizeClass] = freeBlock;
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReleaseAll
+
+	Returns every slab to the system at once.  Every block handed out becomes
+	invalid, so any node still in the arena must already have been destroyed.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeNodeArena::ReleaseAll(void)
+{
+	size_t
+		i;
+
+	for (i = 0; i < fSlabs.size(); i += 1)
+	{
+		free(fSlabs[i]);
+	}
+
+	fSlabs.clear();
+	fFreeLists.clear();
+	fNext = nullptr;
+	fEnd = nullptr;
+}
@@ -0,0 +1,88 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREENODEARENA_
+#define _NTREENODEARENA_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeNodeArena.h
+
+		Every NTree owns a NTreeNodeArena that NTree::CreateNode() builds nodes in.
+		Memory is taken from the system in large slabs and handed out in order, so a
+		tree built in one pass lies in a few contiguous blocks instead of one heap
+		block per node, and the tree frees it all with a few calls when it goes away.
+
+		A block given back with Free() goes on a list for its size and is the first
+		choice for the next node of that size.  Blocks never return to the system
+		before the arena is destroyed or ReleaseAll() is called.
+
+		The arena only manages memory.  Constructing and destroying the nodes is up
+		to NTree::CreateNode() and NTree::DeleteNode().
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <cstddef>
+#include <vector>
+
+class NTreeNodeArena;
+typedef class NTreeNodeArena* NTreeNodeArenaPtr;
+
+class NTreeNodeArena
+{
+public:
+
+	enum
+	{
+		kSlabSize = 64 * 1024,			// bytes taken from the system at a time
+		kAlignment = sizeof(void*),		// every block is aligned to this
+		kHeaderSize = sizeof(void*)		// each block is preceded by its size
+	};
+
+	NTreeNodeArena(void);
+	~NTreeNodeArena();
+
+	void* Allocate(size_t);
+	void Free(void*);
+	void ReleaseAll(void);
+
+	size_t GetNumSlabs(void) const { return fSlabs.size(); }
+
+private:
+
+	/* An arena owns its slabs, so it can't be copied. */
+	NTreeNodeArena(const NTreeNodeArena&);
+	NTreeNodeArena& operator=(const NTreeNodeArena&);
+
+	struct FreeBlock
+	{
+		FreeBlock*
+			next;
+	};
+
+	std::vector<char*> fSlabs;			// every block of memory taken from the system
+	char* fNext;						// next free byte of the current slab
+	char* fEnd;							// end of the current slab
+	std::vector<FreeBlock*> fFreeLists;	// blocks given back, indexed by size / kAlignment
+};
+
+#endif
@@ -25,3 +25,7 @@
 #define kNTreeNodeSpawning			(1<<1)
 #define kNTreeNodeDontDisposeNode	(1<<2)
 
+/* Set by NTreeNode::MarkDirty when a node of a tree that tracks changes is changed, and
+	cleared when the tree is saved (see NTree::WriteDelta).  It is never written to a file. */
+#define kNTreeNodeFlagDirty			(1<<3)
+
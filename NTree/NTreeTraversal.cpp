@@ -0,0 +1,123 @@
+// --------------------------------------------------------------------------------
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeTraversal.h"
+
+
+// --------------------------------------------------------------------------------
+/*
+	Each thread keeps its own list of idle contexts.  Nested traversals take one
+	context each, so the list grows to the deepest nesting the thread has used and
+	is freed when the thread exits.
+*/
+// --------------------------------------------------------------------------------
+struct NTreeTraversalContextPool
+{
+	NTreeTraversalContextPtr
+		head;
+
+	NTreeTraversalContextPool(void) : head(nullptr) {}
+
+	~NTreeTraversalContextPool()
+	{
+		while (head != nullptr)
+		{
+			NTreeTraversalContextPtr
+				context = head;
+
+			head = context->fNext;
+			delete context;
+		}
+	}
+};
+
+static thread_local NTreeTraversalContextPool sContextPool;
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeTraversalContext
+*/
+// --------------------------------------------------------------------------------
+NTreeTraversalContext::NTreeTraversalContext(void)
+{
+	fNext = nullptr;
+	fStack.reserve(kInitialDepth);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeTraversalContext
+*/
+// --------------------------------------------------------------------------------
+NTreeTraversalContext::~NTreeTraversalContext()
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Acquire
+
+	Returns an empty context from the calling thread's pool, creating one if the
+	pool is empty.  Give it back with Release().
+*/
+// --------------------------------------------------------------------------------
+NTreeTraversalContextPtr
+NTreeTraversalContext::Acquire(void)
+{
+	NTreeTraversalContextPtr
+		context = sContextPool.head;
+
+	if (context != nullptr)
+	{
+		sContextPool.head = context->fNext;
+		context->fNext = nullptr;
+	}
+	else
+	{
+		context = new NTreeTraversalContext();
+	}
+
+	return context;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Release
+
+	Returns a context to the calling thread's pool.  The frame stack keeps its
+	memory for the next traversal.
+*/
+// --------------------------------------------------------------------------------
+void
+NTreeTraversalContext::Release(NTreeTraversalContextPtr inContext)
+{
+	if (inContext != nullptr)
+	{
+		inContext->Reset();
+		inContext->fNext = sContextPool.head;
+		sContextPool.head = inContext;
+	}
+}
@@ -0,0 +1,357 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREETRAVERSAL_
+#define _NTREETRAVERSAL_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeTraversal.h
+
+		A NTreeTraversalContext holds the state of one VisitAllNTreeNodes pass: the
+		stack of (node, next child index) frames.  Nothing about a traversal is kept
+		in the NTree or in statics, so any number of threads may traverse separate
+		trees (or share a tree they only read) at the same time, and an action
+		procedure may start a nested traversal as deep as memory allows.
+
+		Contexts are cheap to keep around.  Acquire() hands out one from a pool owned
+		by the calling thread, and Release() returns it with its stack memory intact,
+		so steady-state traversals don't allocate.  A context may also simply be
+		declared on the stack and passed to VisitAllNTreeNodes.
+
+		NTreeVisitNodes is the traversal engine itself.  It is a template on the entry
+		and exit actions, which may be any callable taking an NTreeNodePtr (function
+		objects, lambdas, ...).  The compiler can inline them into the loop.
+		NTreeNoAction stands in for the side that has nothing to do.
+
+		An action returns either a bool (true to abort) or an NTreeVisitResult, which
+		lets it steer the traversal: skip the node's children, skip the rest of its
+		siblings, or stop.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <utility>
+#include <vector>
+#include "NTreeNode.h"
+
+/* The result type of calling an action with a node.  Used to keep the kActionOnEntry and
+	kEntireTree flags from being taken for actions when overloading on them. */
+#define NTreeActionResultOf(Action) decltype(std::declval<Action&>()(NTreeNodePtr()))
+
+/* What an action tells the traversal to do next.  false and true convert to
+	kNTreeVisitContinue and kNTreeVisitStop. */
+enum NTreeVisitResult
+{
+	kNTreeVisitContinue = 0,		// go on as usual
+	kNTreeVisitStop = 1,			// end the traversal, VisitAllNTreeNodes returns true
+	kNTreeVisitSkipChildren = 2,	// (entry only) don't descend into this node's children
+	kNTreeVisitSkipSiblings = 3		// don't visit the siblings after this node (its own children are still visited)
+};
+
+inline NTreeVisitResult NTreeToVisitResult(bool inAbort) { return inAbort ? kNTreeVisitStop : kNTreeVisitContinue; }
+inline NTreeVisitResult NTreeToVisitResult(NTreeVisitResult inResult) { return inResult; }
+
+struct NTreeTraversalFrame
+{
+	NTreeNodePtr
+		node;
+	long
+		nextChild;	// index of the next child to visit
+	long
+		wrapEnd;	// when climbing out of the start node, children before this index are visited last
+	bool
+		wrapped;
+	bool
+		skipRemaining;	// an action asked to skip the children that are left
+};
+typedef struct NTreeTraversalFrame NTreeTraversalFrame;
+
+class NTreeTraversalContext;
+typedef class NTreeTraversalContext* NTreeTraversalContextPtr;
+
+class NTreeTraversalContext
+{
+public:
+
+	enum
+	{
+		kInitialDepth = 32
+	};
+
+	NTreeTraversalContext(void);
+	~NTreeTraversalContext();
+
+	/* Per-thread pool */
+	static NTreeTraversalContextPtr Acquire(void);
+	static void Release(NTreeTraversalContextPtr);
+
+	/* Frame stack */
+	void Reset(void) { fStack.clear(); }
+	bool IsEmpty(void) const { return fStack.empty(); }
+	size_t GetDepth(void) const { return fStack.size(); }
+	NTreeTraversalFrame& Top(void) { return fStack.back(); }
+	void Pop(void) { fStack.pop_back(); }
+	void Push(NTreeNodePtr inNode, long inNextChild, long inWrapEnd, bool inSkipRemaining = false)
+	{
+		NTreeTraversalFrame
+			frame;
+
+		frame.node = inNode;
+		frame.nextChild = inNextChild;
+		frame.wrapEnd = inWrapEnd;
+		frame.wrapped = false;
+		frame.skipRemaining = inSkipRemaining;
+		fStack.push_back(frame);
+	}
+
+private:
+
+	friend struct NTreeTraversalContextPool;
+
+	NTreeTraversalContext(const NTreeTraversalContext&);
+	NTreeTraversalContext& operator=(const NTreeTraversalContext&);
+
+	std::vector<NTreeTraversalFrame> fStack;
+	NTreeTraversalContextPtr fNext;		// next free context in this thread's pool
+};
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeTraversalContextHolder
+
+	Takes a context from the calling thread's pool for the life of the holder.
+*/
+// --------------------------------------------------------------------------------
+class NTreeTraversalContextHolder
+{
+public:
+
+	NTreeTraversalContextHolder(void) : fContext(NTreeTraversalContext::Acquire()) {}
+	~NTreeTraversalContextHolder() { NTreeTraversalContext::Release(fContext); }
+
+	NTreeTraversalContext& operator*(void) const { return *fContext; }
+
+private:
+
+	NTreeTraversalContextHolder(const NTreeTraversalContextHolder&);
+	NTreeTraversalContextHolder& operator=(const NTreeTraversalContextHolder&);
+
+	NTreeTraversalContextPtr fContext;
+};
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeNoAction
+
+	The action to pass for the entry or exit side of a traversal that has nothing
+	to do there.  It never aborts, and compiles away.
+*/
+// --------------------------------------------------------------------------------
+struct NTreeNoAction
+{
+	NTreeVisitResult operator()(NTreeNodePtr) const { return kNTreeVisitContinue; }
+};
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeVisitNodes
+
+	Depth first traversal starting at inStartNode.  inEntryAction is called on a
+	node before any of its children are visited, inExitAction after the last one.
+	Returns true if an action stopped the traversal (returned true or
+	kNTreeVisitStop).
+
+	The traversal keeps an explicit stack of (node, next child index) frames in
+	ioContext, so each edge is walked exactly once and no per-node "visited" state
+	is needed.  The context must not be in use by another traversal.
+
+	The child count is read again after the entry action, so an entry action may
+	add children to the node it is called on (this is how trees are grown
+	on-the-fly).  An exit action may remove and delete the node it is called on.
+
+	kNTreeVisitSkipChildren from an entry action goes straight to the node's exit
+	action.  kNTreeVisitSkipSiblings from either action leaves the node's parent
+	once the node is done.
+
+	If inDoOnlyThisBranch is false and the start node is not the root, the
+	traversal climbs to the start node's parent once its branch is done.  Each
+	ancestor gets its entry action, then its remaining children are visited,
+	wrapping around to the children before the one we climbed out of, and then it
+	gets its exit action.
+*/
+// --------------------------------------------------------------------------------
+template <class EntryAction, class ExitAction>
+bool NTreeVisitNodes
+(
+	NTreeTraversalContext& ioContext,
+	NTreeNodePtr inStartNode,
+	EntryAction& inEntryAction,
+	ExitAction& inExitAction,
+	bool inDoOnlyThisBranch
+)
+{
+	NTreeNodePtr
+		node = inStartNode;
+	NTreeNodePtr
+		parent = nullptr;
+	long
+		childIndex = -1;
+	NTreeVisitResult
+		result = kNTreeVisitContinue;
+	bool
+		skipParent = false;	// the bottom frame's node asked to skip its siblings
+	bool
+		abort = false;
+
+
+	ioContext.Reset();
+
+	if (node == nullptr)
+	{
+		goto Exit;
+	}
+
+	// Enter the start node.
+	result = NTreeToVisitResult(inEntryAction(node));
+	if (result == kNTreeVisitStop)
+	{
+		abort = true;
+		goto Exit;
+	}
+
+	skipParent = (result == kNTreeVisitSkipSiblings);
+	ioContext.Push(node, 0, 0, (result == kNTreeVisitSkipChildren));
+
+	// Loop until the stack is empty, this means we have visited all nodes.
+	while (!ioContext.IsEmpty())
+	{
+		NTreeTraversalFrame&
+			top = ioContext.Top();
+		long
+			numChildren = top.skipRemaining ? 0 : top.node->GetNumChildren();
+
+		// Once the children after the one we climbed out of are done, go back for the ones before it.
+		if (!top.wrapped && (top.nextChild >= numChildren) && (top.wrapEnd > 0) && !top.skipRemaining)
+		{
+			top.wrapped = true;
+			top.nextChild = 0;
+		}
+
+		if (top.wrapped && (top.wrapEnd < numChildren))
+		{
+			numChildren = top.wrapEnd;
+		}
+
+		// Drop down to the next child.
+		if (top.nextChild < numChildren)
+		{
+			node = top.node->GetChild(static_cast<NTreeChildIndex>(top.nextChild));
+
+			result = NTreeToVisitResult(inEntryAction(node));
+			if (result == kNTreeVisitStop)
+			{
+				abort = true;
+				goto Exit;
+			}
+
+			if (result == kNTreeVisitSkipSiblings)
+			{
+				top.skipRemaining = true;
+			}
+
+			ioContext.Push(node, 0, 0, (result == kNTreeVisitSkipChildren));
+			continue;
+		}
+
+		// All children are done.  We do this just in case the action function wants to dispose of the node.
+		node = top.node;
+		parent = node->GetParent();
+		ioContext.Pop();
+
+		// If we're about to climb out of the start node, remember where it sits in its parent.
+		childIndex = -1;
+		if (ioContext.IsEmpty() && !inDoOnlyThisBranch && (parent != nullptr))
+		{
+			childIndex = parent->FindChildIndexByAddress(node);
+		}
+
+		result = NTreeToVisitResult(inExitAction(node));
+		if (result == kNTreeVisitStop)
+		{
+			abort = true;
+			goto Exit;
+		}
+		// node is possibly invalid here.
+
+		if (!ioContext.IsEmpty())
+		{
+			NTreeTraversalFrame&
+				up = ioContext.Top();
+
+			// Step past the child we just finished, unless the action removed it from the parent.
+			if ((up.nextChild < up.node->GetNumChildren()) && (up.node->GetChild(static_cast<NTreeChildIndex>(up.nextChild)) == node))
+			{
+				up.nextChild += 1;
+			}
+			else if (up.wrapped)
+			{
+				up.wrapEnd -= 1;
+			}
+
+			if (result == kNTreeVisitSkipSiblings)
+			{
+				up.skipRemaining = true;
+			}
+		}
+		else if (childIndex >= 0)
+		{
+			// Climb up to the parent of the start node and visit the rest of the tree.
+			long
+				nextChild = childIndex;
+
+			if ((childIndex < parent->GetNumChildren()) && (parent->GetChild(static_cast<NTreeChildIndex>(childIndex)) == node))
+			{
+				nextChild += 1;
+			}
+
+			skipParent = skipParent || (result == kNTreeVisitSkipSiblings);
+
+			result = NTreeToVisitResult(inEntryAction(parent));
+			if (result == kNTreeVisitStop)
+			{
+				abort = true;
+				goto Exit;
+			}
+
+			ioContext.Push(parent, nextChild, childIndex, skipParent || (result == kNTreeVisitSkipChildren));
+			skipParent = (result == kNTreeVisitSkipSiblings);
+		}
+	}
+
+Exit:
+
+	ioContext.Reset();
+
+	return abort;
+}
+
+#endif
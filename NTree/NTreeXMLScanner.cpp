@@ -0,0 +1,343 @@
+// --------------------------------------------------------------------------------
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeXMLScanner.h"
+#include <cstring>
+
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeXMLScanner
+
+	inFile must be open for reading, at the start of the XML.  It is not closed.
+*/
+// --------------------------------------------------------------------------------
+NTreeXMLScanner::NTreeXMLScanner
+(
+	FILE* inFile,
+	size_t inBlockSize
+)
+{
+	fFile = inFile;
+	fBlock.resize((inBlockSize > 0) ? inBlockSize : size_t(kDefaultBlockSize));
+	fData = fBlock.data();
+	fPos = 0;
+	fValid = 0;
+	fError = false;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeXMLScanner
+
+	Scans the inSize bytes at inData, which must stay put until the scanner is
+	done with them.
+*/
+// --------------------------------------------------------------------------------
+NTreeXMLScanner::NTreeXMLScanner
+(
+	const char* inData,
+	size_t inSize
+)
+{
+	fFile = nullptr;
+	fData = inData;
+	fPos = 0;
+	fValid = (inData != nullptr) ? inSize : 0;
+	fError = false;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeXMLScanner
+*/
+// --------------------------------------------------------------------------------
+NTreeXMLScanner::~NTreeXMLScanner()
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Next
+
+	Reads up to and including the next tag, and sets outToken to what it is.
+	At the end of the file outToken is kEndOfFile.
+
+	Returns 0 if no error, or non-zero if the file can't be read or ends inside
+	markup.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeXMLScanner::Next(Token& outToken)
+{
+	long
+		error = 0;
+	int
+		c;
+
+	fName.clear();
+	fTag.clear();
+
+	for (;;)
+	{
+		/* Text between tags. */
+		do
+		{
+			c = Get();
+		} while ((c != EOF) && (c != '<'));
+
+		if (c == EOF)
+		{
+			outToken = kEndOfFile;
+			error = fError ? -1 : 0;
+			break;
+		}
+
+		c = Get();
+		if (c == '?')
+		{
+			error = SkipPast("?>");
+		}
+		else if (c == '!')
+		{
+			error = SkipDeclaration();
+		}
+		else if (c == '/')
+		{
+			outToken = kEndTag;
+			error = ReadEndTag();
+			break;
+		}
+		else
+		{
+			error = ReadTag(c);
+			outToken = ((fTag.size() >= 2) && (fTag[fTag.size() - 2] == '/')) ? kEmptyTag : kStartTag;
+			break;
+		}
+
+		if (error != 0)
+		{
+			break;
+		}
+	}
+
+	return error;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Get
+
+	Returns the next character, or EOF.
+*/
+// --------------------------------------------------------------------------------
+int
+NTreeXMLScanner::Get(void)
+{
+	if (fPos == fValid)
+	{
+		if (fError || (fFile == nullptr))
+		{
+			return EOF;
+		}
+
+		fValid = fread(fBlock.data(), 1, fBlock.size(), fFile);
+		fData = fBlock.data();
+		fPos = 0;
+		if (fValid == 0)
+		{
+			fError = (ferror(fFile) != 0);
+			return EOF;
+		}
+	}
+
+	return static_cast<unsigned char>(fData[fPos++]);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	SkipPast
+
+	Skips up to and including inEnd: "?>", "-->" or "]]>".  Returns non-zero if
+	the file ends first.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeXMLScanner::SkipPast(const char* inEnd)
+{
+	size_t
+		length = strlen(inEnd);
+	size_t
+		matched = 0;
+	int
+		c;
+
+	while (matched < length)
+	{
+		c = Get();
+		if (c == EOF)
+		{
+			return -1;
+		}
+
+		if (c == inEnd[matched])
+		{
+			matched += 1;
+		}
+		else if (c != inEnd[0])
+		{
+			/* The terminators are a run of one character then another, as in "]]>",
+				so another of the run keeps what has matched ("]]]>"). */
+			matched = 0;
+		}
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	SkipDeclaration
+
+	Skips what follows "<!": a comment, a CDATA section or a DOCTYPE, whose
+	internal subset may hold '>' inside brackets.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeXMLScanner::SkipDeclaration(void)
+{
+	int
+		c = Get();
+	int
+		depth = 0;
+
+	if (c == '-')
+	{
+		if (Get() != '-')
+		{
+			return -1;
+		}
+		return SkipPast("-->");
+	}
+
+	if (c == '[')
+	{
+		return SkipPast("]]>");
+	}
+
+	while (c != EOF)
+	{
+		if (c == '[')
+		{
+			depth += 1;
+		}
+		else if (c == ']')
+		{
+			depth -= 1;
+		}
+		else if ((c == '>') && (depth <= 0))
+		{
+			return 0;
+		}
+		c = Get();
+	}
+
+	return -1;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadTag
+
+	Reads a start or empty element tag into fTag, inFirst being the character
+	after the '<', and its name into fName.  A '>' inside a quoted attribute
+	value doesn't end the tag.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeXMLScanner::ReadTag(int inFirst)
+{
+	int
+		c = inFirst;
+	int
+		quote = 0;
+
+	fTag = '<';
+	while (c != EOF)
+	{
+		fTag += char(c);
+		if (quote != 0)
+		{
+			if (c == quote)
+			{
+				quote = 0;
+			}
+		}
+		else if ((c == '"') || (c == '\''))
+		{
+			quote = c;
+		}
+		else if (c == '>')
+		{
+			break;
+		}
+		c = Get();
+	}
+
+	if (c == EOF)
+	{
+		return -1;
+	}
+
+	fName.assign(fTag, 1, fTag.find_first_of(" \t\r\n/>", 1) - 1);
+
+	return fName.empty() ? -1 : 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	ReadEndTag
+
+	Reads the name of an end tag into fName, up to and including the '>'.
+*/
+// --------------------------------------------------------------------------------
+long
+NTreeXMLScanner::ReadEndTag(void)
+{
+	int
+		c = Get();
+
+	while ((c != EOF) && (c != '>'))
+	{
+		if ((c != ' ') && (c != '\t') && (c != '\r') && (c != '\n'))
+		{
+			fName += char(c);
+		}
+		c = Get();
+	}
+
+	return ((c == EOF) || fName.empty()) ? -1 : 0;
+}
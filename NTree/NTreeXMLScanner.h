@@ -0,0 +1,100 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREEXMLSCANNER_
+#define _NTREEXMLSCANNER_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeXMLScanner.h
+
+		Reads XML one tag at a time, in a single forward pass over the file,
+		for NTree::ReadXML.  Nothing is kept of the document but the tag just
+		read, so files of any size are read in the same small amount of memory.
+
+		Only what a tree needs is picked out: start tags (with their attributes),
+		empty element tags and end tags.  Text, comments, CDATA sections, the
+		declaration, processing instructions and DOCTYPE are skipped.  The tags
+		aren't checked beyond being closed and having a name; the caller pairs
+		up start and end tags and parses each start tag's attributes.
+
+		A file is read through a block of kDefaultBlockSize bytes.  XML already in
+		memory (received, unpacked, or a mapped file) is scanned where it is,
+		without being copied.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class NTreeXMLScanner
+{
+public:
+
+	enum Token
+	{
+		kEndOfFile,
+		kStartTag,			// <name ...>
+		kEmptyTag,			// <name .../>
+		kEndTag				// </name>
+	};
+
+	enum
+	{
+		kDefaultBlockSize = 64 * 1024
+	};
+
+	NTreeXMLScanner(FILE*, size_t = kDefaultBlockSize);
+	NTreeXMLScanner(const char*, size_t);
+	~NTreeXMLScanner();
+
+	long Next(Token&);
+
+	/* The tag Next just read: its name, and for start and empty element tags
+		the whole tag, from the '<' to the '>'. */
+	const std::string& GetName(void) const { return fName; }
+	const std::string& GetTag(void) const { return fTag; }
+
+private:
+
+	NTreeXMLScanner(const NTreeXMLScanner&);
+	NTreeXMLScanner& operator=(const NTreeXMLScanner&);
+
+	int Get(void);
+	long SkipPast(const char*);
+	long SkipDeclaration(void);
+	long ReadTag(int);
+	long ReadEndTag(void);
+
+	FILE* fFile;						// nullptr when scanning memory
+	std::vector<char> fBlock;
+	const char* fData;					// fBlock, or the caller's memory
+	size_t fPos;						// next character in fData
+	size_t fValid;						// characters in fData
+	bool fError;						// the file couldn't be read
+	std::string fName;
+	std::string fTag;
+};
+
+#endif
@@ -0,0 +1,326 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+// --------------------------------------------------------------------------------
+#include "pch.h"
+#include "framework.h"
+
+#include "NTreeXMLTypes.h"
+#include "tinyxml2.h"
+
+using namespace tinyxml2;
+
+
+// --------------------------------------------------------------------------------
+/*
+	NTreeXMLTypeTable
+*/
+// --------------------------------------------------------------------------------
+NTreeXMLTypeTable::NTreeXMLTypeTable(void)
+{
+	fLastEntry = nullptr;
+	fLastType = 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	~NTreeXMLTypeTable
+*/
+// --------------------------------------------------------------------------------
+NTreeXMLTypeTable::~NTreeXMLTypeTable()
+{
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Clear
+
+	Forgets every type.  Names handed out by GetTagName are no longer good.
+*/
+// --------------------------------------------------------------------------------
+void NTreeXMLTypeTable::Clear(void)
+{
+	std::lock_guard<std::mutex>
+		guard(fMutex);
+
+	fEntries.clear();
+	fLastEntry = nullptr;
+	fLastType = 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Register
+
+	Elements named for inType are made into nodes by inReanimateFunc, which is
+	passed the type and the element's id attribute.  Registering a type again
+	replaces its function.
+*/
+// --------------------------------------------------------------------------------
+void NTreeXMLTypeTable::Register(NTreeNodeType inType, NTreeNodeReanimateFunc inReanimateFunc)
+{
+	std::lock_guard<std::mutex>
+		guard(fMutex);
+
+	Intern(inType).reanimateFunc = inReanimateFunc;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Unregister
+
+	Elements named for inType are no longer read.  The name is kept, as the
+	printer may still point at it.
+*/
+// --------------------------------------------------------------------------------
+void NTreeXMLTypeTable::Unregister(NTreeNodeType inType)
+{
+	std::lock_guard<std::mutex>
+		guard(fMutex);
+	std::unordered_map<NTreeNodeType, Entry>::iterator
+		found = fEntries.find(inType);
+
+	if (found != fEntries.end())
+	{
+		found->second.reanimateFunc = nullptr;
+	}
+}
+
+// --------------------------------------------------------------------------------
+/*
+	IsRegistered
+*/
+// --------------------------------------------------------------------------------
+bool NTreeXMLTypeTable::IsRegistered(NTreeNodeType inType) const
+{
+	std::lock_guard<std::mutex>
+		guard(fMutex);
+	const Entry*
+		entry = FindEntry(inType);
+
+	return (entry != nullptr) && (entry->reanimateFunc != nullptr);
+}
+
+// --------------------------------------------------------------------------------
+/*
+	GetTagName
+
+	Returns the element name WriteXML uses for inType: its four characters
+	without leading zero bytes, or "node" if they aren't a valid XML name.
+	The name lasts until the table is cleared.
+*/
+// --------------------------------------------------------------------------------
+const char* NTreeXMLTypeTable::GetTagName(NTreeNodeType inType)
+{
+	std::lock_guard<std::mutex>
+		guard(fMutex);
+
+	return Intern(inType).name.c_str();
+}
+
+// --------------------------------------------------------------------------------
+/*
+	FindType
+
+	Sets outType to the type inElement stands for: its name packed back into
+	a type code, or its type attribute if it is a <node>.
+
+	Returns 0 if no error.
+*/
+// --------------------------------------------------------------------------------
+long NTreeXMLTypeTable::FindType(const XMLElement* inElement, NTreeNodeType& outType) const
+{
+	unsigned
+		type = 0;
+
+	if ((inElement == nullptr) || !PackTagName(inElement->Name(), outType))
+	{
+		return -1;
+	}
+
+	if ((outType == 'node') && (inElement->QueryUnsignedAttribute("type", &type) == XML_NO_ERROR))
+	{
+		outType = NTreeNodeType(type);
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Reanimate
+
+	Makes a node for inElement with the function registered for its type.
+	Only the type and ID are set; the caller has the node read the rest with
+	NTreeNode::ReadXMLAttributes.
+
+	Returns nullptr if the type isn't registered or the function fails.
+*/
+// --------------------------------------------------------------------------------
+NTreeNodePtr NTreeXMLTypeTable::Reanimate(XMLElement* inElement) const
+{
+	NTreeNodeType
+		type = 0;
+	NTreeNodeReanimateFunc
+		reanimateFunc = nullptr;
+	unsigned
+		id = NTreeNode::kUnassignedID;
+
+	if (FindType(inElement, type) != 0)
+	{
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex>
+			guard(fMutex);
+		const Entry*
+			entry = FindEntry(type);
+
+		if (entry != nullptr)
+		{
+			reanimateFunc = entry->reanimateFunc;
+		}
+	}
+
+	if (reanimateFunc == nullptr)
+	{
+		return nullptr;
+	}
+
+	inElement->QueryUnsignedAttribute("id", &id);
+
+	return (*reanimateFunc)(type, NTreeNodeID(id));
+}
+
+// --------------------------------------------------------------------------------
+/*
+	PackTagName
+
+	Packs an element name of one to four characters into the type code it was
+	made from, the last character in the low byte.  Returns false if the name
+	is longer, so no type has it.
+*/
+// --------------------------------------------------------------------------------
+bool NTreeXMLTypeTable::PackTagName(const char* inName, NTreeNodeType& outType)
+{
+	unsigned long
+		code = 0;
+	int
+		i;
+
+	if ((inName == nullptr) || (inName[0] == 0))
+	{
+		return false;
+	}
+
+	for (i = 0; inName[i] != 0; i += 1)
+	{
+		if (i == 4)
+		{
+			return false;
+		}
+		code = (code << 8) | static_cast<unsigned char>(inName[i]);
+	}
+
+	outType = NTreeNodeType(code);
+	return true;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Intern
+
+	Returns inType's entry, adding it with its element name if it is new.
+	fMutex must be held.
+*/
+// --------------------------------------------------------------------------------
+NTreeXMLTypeTable::Entry& NTreeXMLTypeTable::Intern(NTreeNodeType inType)
+{
+	std::unordered_map<NTreeNodeType, Entry>::iterator
+		found = fEntries.find(inType);
+	Entry
+		entry;
+	int
+		shift;
+	char
+		c;
+
+	if (found != fEntries.end())
+	{
+		return found->second;
+	}
+
+	for (shift = 24; shift >= 0; shift -= 8)
+	{
+		c = char((inType >> shift) & 0xFF);
+		if ((c == 0) && entry.name.empty())
+		{
+			continue;
+		}
+		if (!(((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || (c == '_') ||
+			(!entry.name.empty() && (((c >= '0') && (c <= '9')) || (c == '-') || (c == '.')))))
+		{
+			entry.name.clear();
+			break;
+		}
+		entry.name += c;
+	}
+
+	/* Names starting with "xml" are reserved. */
+	if (entry.name.empty() || (entry.name.compare(0, 3, "xml") == 0) || (entry.name.compare(0, 3, "XML") == 0))
+	{
+		entry.name = "node";
+	}
+	entry.reanimateFunc = nullptr;
+
+	return fEntries.emplace(inType, entry).first->second;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	FindEntry
+
+	Returns inType's entry, or nullptr.  The last one found is checked first.
+	fMutex must be held.
+*/
+// --------------------------------------------------------------------------------
+const NTreeXMLTypeTable::Entry* NTreeXMLTypeTable::FindEntry(NTreeNodeType inType) const
+{
+	std::unordered_map<NTreeNodeType, Entry>::const_iterator
+		found;
+
+	if ((fLastEntry != nullptr) && (fLastType == inType))
+	{
+		return fLastEntry;
+	}
+
+	found = fEntries.find(inType);
+	if (found == fEntries.end())
+	{
+		return nullptr;
+	}
+
+	fLastEntry = &found->second;
+	fLastType = inType;
+
+	return fLastEntry;
+}
@@ -0,0 +1,97 @@
+/*
+	The MIT License (MIT)
+	Copyright  2020 Douglas Corarito
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the Software), to deal in the
+	Software without restriction, including without limitation the rights to use, copy,
+	modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+	and to permit persons to whom the Software is furnished to do so, subject to the
+	following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED AS IS, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+	PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+	HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+	OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NTREEXMLTYPES_
+#define _NTREEXMLTYPES_
+
+// --------------------------------------------------------------------------------
+/*
+		NTreeXMLTypes.h
+
+		The table NTree keeps of node types and their XML element names.
+
+		WriteXML names each node's element for its type's four characters ('LETR'
+		is <LETR>).  Going the other way, a name of up to four characters is packed
+		back into its type code, so finding an element's type is a hash lookup on
+		a number, with no string comparisons.  Types whose characters don't make a
+		valid XML name are written as <node type="...">.
+
+		Register a type with the NTreeNodeReanimateFunc that makes its nodes, and
+		ReadXML can make them without an NTreeNodeReanimateXMLFunc: the table
+		finds the type from the element's name, calls the function with the type
+		and the element's id attribute, and lets the node read the rest of its
+		attributes (see NTreeNode::ReadXMLAttributes).
+
+		The table has a lock of its own, so that WriteXML may run on several
+		threads reading the same tree.
+
+		See NTree.h for more information about NTrees.
+*/
+// --------------------------------------------------------------------------------
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "NTreeNode.h"
+
+class NTreeXMLTypeTable
+{
+public:
+
+	NTreeXMLTypeTable(void);
+	~NTreeXMLTypeTable();
+
+	void Clear(void);
+	void Register(NTreeNodeType, NTreeNodeReanimateFunc);
+	void Unregister(NTreeNodeType);
+	bool IsRegistered(NTreeNodeType) const;
+
+	/* Export: the element name for a type, kept here so the pointer stays good. */
+	const char* GetTagName(NTreeNodeType);
+
+	/* Import: the type an element stands for, and a node made for it. */
+	long FindType(const tinyxml2::XMLElement*, NTreeNodeType&) const;
+	NTreeNodePtr Reanimate(tinyxml2::XMLElement*) const;
+
+	static bool PackTagName(const char*, NTreeNodeType&);
+
+private:
+
+	struct Entry
+	{
+		std::string name;						// the element name, "node" if the type has none
+		NTreeNodeReanimateFunc reanimateFunc;	// nullptr if only named, not registered
+	};
+	typedef struct Entry Entry;
+
+	NTreeXMLTypeTable(const NTreeXMLTypeTable&);
+	NTreeXMLTypeTable& operator=(const NTreeXMLTypeTable&);
+
+	Entry& Intern(NTreeNodeType);
+	const Entry* FindEntry(NTreeNodeType) const;
+
+	mutable std::mutex fMutex;					// held by every call that looks at fEntries
+	std::unordered_map<NTreeNodeType, Entry> fEntries;
+	mutable const Entry* fLastEntry;			// the last type found, as siblings tend to match
+	mutable NTreeNodeType fLastType;
+};
+
+#endif
@@ -1,16 +1,22 @@
 #pragma once
 #include "../NTree/NTreeNode.h"
 
-extern NTreeNodeID GetNextNodeId();;
-
 class LetterNode : public NTreeNode
 {
 public:
 
 	char letter;
 
-	LetterNode(char l) : NTreeNode(NTreeNodeType('LETR'), GetNextNodeId())
+	LetterNode(NTreeNodeID id, char l) : NTreeNode(NTreeNodeType('LETR'), id)
 	{
 		letter = l;
 	}
+
+	// A copy is cheaper for NTree::WriteAsync than capturing the record.
+	NTreeNodePtr CloneForWrite(long) override
+	{
+		LetterNode* copy = new LetterNode(GetID(), letter);
+		copy->SetFlags(GetFlags());
+		return copy;
+	}
 };
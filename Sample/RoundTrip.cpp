@@ -0,0 +1,383 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "../NTree/NTree.h"
+#include "../NTree/NTreeNode.h"
+#include "../NTree/NTreeNodeFlags.h"
+
+#include "RoundTrip.h"
+
+using namespace std;
+
+// A flag of the application's own, so there is something besides the shape to carry.
+#define kRoundTripFlagMarked	(1<<8)
+
+// 'xmlT' can't be an element name, as names starting with "xml" are reserved, and 1 has
+// no printable characters at all, so both are written as <node type="...">.
+static const NTreeNodeType kRoundTripTypes[] = { NTreeNodeType('LETR'), NTreeNodeType('WORD'), NTreeNodeType('xmlT'), 1 };
+
+// Files are kept in memory, so ReadIndexed may read one from several threads at once.
+struct MemoryFile
+{
+	vector<unsigned char> bytes;
+};
+
+static long MemoryWrite(void* file, void* data, unsigned long size, unsigned long count, long offset)
+{
+	vector<unsigned char>& bytes = static_cast<MemoryFile*>(file)->bytes;
+	size_t length = size_t(size) * count;
+
+	if (offset < 0)
+		return -1;
+
+	if (bytes.size() < size_t(offset) + length)
+		bytes.resize(size_t(offset) + length);
+	memcpy(bytes.data() + offset, data, length);
+
+	return 0;
+}
+
+static long MemoryRead(void* file, void* data, unsigned long size, unsigned long count, long offset)
+{
+	const vector<unsigned char>& bytes = static_cast<MemoryFile*>(file)->bytes;
+	size_t length = size_t(size) * count;
+
+	if ((offset < 0) || (size_t(offset) + length > bytes.size()))
+		return -1;
+	memcpy(data, bytes.data() + offset, length);
+
+	return 0;
+}
+
+// A subclass that doesn't override CloneForWrite, so WriteAsync copies its record.
+class PlainSubclassNode : public NTreeNode
+{
+public:
+
+	PlainSubclassNode(NTreeNodeType type, NTreeNodeID id) : NTreeNode(type, id) {}
+};
+
+static long FailingWrite(void*, void*, unsigned long, unsigned long, long)
+{
+	return -1;
+}
+
+static NTreeNodePtr MakeNode(NTreeNodeType type, NTreeNodeID id)
+{
+	return new NTreeNode(type, id);
+}
+
+// One line per node, in preorder: its type, ID, flags and number of children.
+static string Describe(NTree& tree)
+{
+	string text;
+	char line[64];
+
+	tree.VisitAllNTreeNodes(
+		tree.GetRoot(),
+		[&text, &line](NTreeNodePtr node)
+		{
+			snprintf(line, sizeof(line), "%08x %u %x %d\n",
+				unsigned(node->GetType()), unsigned(node->GetID()),
+				unsigned(node->GetFlags() & ~kNTreeNodeFlagDirty), int(node->GetNumChildren()));
+			text += line;
+			return false;
+		},
+		NTree::kActionOnEntry,
+		NTree::kEntireTree
+	);
+
+	return text;
+}
+
+static bool Report(const char* what, bool matched)
+{
+	if (!matched)
+		_RPT1(_CRT_WARN, "Round trip failed: %s\n", what);
+
+	return matched;
+}
+
+// Four branches under the root, one of each type, each with three children and six
+// grandchildren; every third node is marked.
+static void Build(NTree& tree)
+{
+	int made = 0;
+
+	for (NTreeNodeType type : kRoundTripTypes)
+	{
+		NTreeNodePtr branch = tree.CreateNode<NTreeNode>(type, tree.NewNodeID());
+		tree.GetRoot()->InsertChild(branch);
+
+		for (int i = 0; i < 3; i += 1)
+		{
+			NTreeNodePtr child = tree.CreateNode<NTreeNode>(NTreeNodeType('LETR'), tree.NewNodeID());
+			branch->InsertChild(child);
+
+			for (int j = 0; j < 2; j += 1)
+			{
+				NTreeNodePtr grandchild = tree.CreateNode<NTreeNode>(NTreeNodeType('WORD'), tree.NewNodeID());
+				child->InsertChild(grandchild);
+				if (++made % 3 == 0)
+					grandchild->SetFlags(kRoundTripFlagMarked);
+			}
+		}
+	}
+}
+
+static bool CheckVersions(NTree& tree)
+{
+	const long versions[] = { long(kNTreeVersion500), long(kNTreeVersion600), long(kNTreeVersion700) };
+	const char* names[] = { "Write/Read version 5", "Write/Read version 6", "Write/Read version 7" };
+	bool matched = true;
+
+	for (int i = 0; i < 3; i += 1)
+	{
+		MemoryFile file;
+		NTree copy;
+		long written = 0;
+		long read = 0;
+
+		bool ok = (tree.Write(&file, written, versions[i], MemoryWrite) == 0)
+			&& (copy.Read(&file, read, versions[i], MakeNode, MemoryRead) == 0)
+			&& (read == written)
+			&& (Describe(copy) == Describe(tree));
+		matched = Report(names[i], ok) && matched;
+	}
+
+	return matched;
+}
+
+static bool CheckIndexed(NTree& tree)
+{
+	MemoryFile plain;
+	MemoryFile indexed;
+	long plainSize = 0;
+	long indexedSize = 0;
+	bool matched = true;
+	bool ok;
+
+	if (!Report("Write and WriteIndexed",
+		(tree.Write(&plain, plainSize, kNTreeVersion, MemoryWrite) == 0)
+		&& (tree.WriteIndexed(&indexed, indexedSize, kNTreeVersion, MemoryWrite) == 0)))
+		return false;
+
+	{
+		NTree copy;
+		long offset = 0;
+
+		ok = (copy.ReadIndexed(&indexed, offset, kNTreeVersion, MakeNode, MemoryRead, 4) == 0)
+			&& (offset == indexedSize)
+			&& (Describe(copy) == Describe(tree));
+		matched = Report("WriteIndexed/ReadIndexed", ok) && matched;
+	}
+
+	{
+		NTree copy;
+		long offset = 0;
+
+		ok = (copy.ReadIndexed(&plain, offset, kNTreeVersion, MakeNode, MemoryRead, 4) == 0)
+			&& (offset == plainSize)
+			&& (Describe(copy) == Describe(tree));
+		matched = Report("Write/ReadIndexed", ok) && matched;
+	}
+
+	{
+		NTree copy;
+		long offset = 0;
+
+		ok = (copy.Read(&indexed, offset, kNTreeVersion, MakeNode, MemoryRead) == 0)
+			&& (offset == indexedSize)
+			&& (Describe(copy) == Describe(tree));
+		matched = Report("WriteIndexed/Read", ok) && matched;
+	}
+
+	{
+		NTree copy;
+
+		ok = (copy.OpenPaged(&indexed, 0, kNTreeVersion, MakeNode, MemoryRead) == 0)
+			&& (copy.PageInAll() == 0)
+			&& (Describe(copy) == Describe(tree));
+		matched = Report("WriteIndexed/OpenPaged", ok) && matched;
+	}
+
+	{
+		NTree copy;
+
+		// Without a table of contents there is nothing to page by.
+		ok = (copy.OpenPaged(&plain, 0, kNTreeVersion, MakeNode, MemoryRead) != 0);
+		matched = Report("Write/OpenPaged refused", ok) && matched;
+	}
+
+	return matched;
+}
+
+// An indexed file records the version it was written with, and is read with that
+// version whatever the caller passes.
+static bool CheckIndexedVersions(NTree& tree)
+{
+	const long written[] = { long(kNTreeVersion600), long(kNTreeVersion) };
+	const long asked[] = { long(kNTreeVersion), long(kNTreeVersion600) };
+	const char* names[] = { "version 6 WriteIndexed read as version 7", "version 7 WriteIndexed read as version 6" };
+	bool matched = true;
+
+	for (int i = 0; i < 2; i += 1)
+	{
+		MemoryFile file;
+		long size = 0;
+		bool ok = (tree.WriteIndexed(&file, size, written[i], MemoryWrite) == 0);
+
+		{
+			NTree copy;
+			long offset = 0;
+
+			ok = ok && (copy.ReadIndexed(&file, offset, asked[i], MakeNode, MemoryRead, 4) == 0)
+				&& (offset == size)
+				&& (Describe(copy) == Describe(tree));
+		}
+
+		{
+			NTree copy;
+			long offset = 0;
+
+			ok = ok && (copy.Read(&file, offset, asked[i], MakeNode, MemoryRead) == 0)
+				&& (offset == size)
+				&& (Describe(copy) == Describe(tree));
+		}
+
+		{
+			NTree copy;
+
+			ok = ok && (copy.OpenPaged(&file, 0, asked[i], MakeNode, MemoryRead) == 0)
+				&& (copy.PageInAll() == 0)
+				&& (Describe(copy) == Describe(tree));
+		}
+
+		matched = Report(names[i], ok) && matched;
+	}
+
+	return matched;
+}
+
+// Saves the tree whole, then twice saves only an edit to it, and checks that reading
+// the whole tree and folding the deltas in gives the tree as it is now.  Leaves the
+// tree edited.
+static bool CheckDeltas(NTree& tree)
+{
+	MemoryFile base;
+	MemoryFile deltas;
+	long baseSize = 0;
+	long deltaSize = 0;
+	NTreeNodeRoot* root = tree.GetRoot();
+
+	if (!Report("Write before WriteDelta", tree.Write(&base, baseSize, kNTreeVersion, MemoryWrite) == 0))
+		return false;
+
+	// Insert, prune and move.
+	NTreeNodePtr added = tree.CreateNode<NTreeNode>(NTreeNodeType('WORD'), tree.NewNodeID());
+	root->GetChild(0)->GetChild(1)->InsertChild(added, 0);
+	tree.Prune(root->GetChild(1)->GetChild(2));
+	root->GetChild(2)->GetChild(0)->Move(root->GetChild(3), 1);
+
+	if (!Report("first WriteDelta", tree.WriteDelta(&deltas, deltaSize, kNTreeVersion, MemoryWrite) == 0))
+		return false;
+
+	// Move a branch that was just edited, mark a node and add one under it.
+	root->GetChild(0)->GetChild(1)->Move(root->GetChild(1), 0);
+	added->SetFlags(kRoundTripFlagMarked);
+	added->InsertChild(tree.CreateNode<NTreeNode>(NTreeNodeType('LETR'), tree.NewNodeID()));
+
+	if (!Report("second WriteDelta", tree.WriteDelta(&deltas, deltaSize, kNTreeVersion, MemoryWrite) == 0))
+		return false;
+
+	NTree copy;
+	long baseOffset = 0;
+	long deltaOffset = 0;
+
+	bool ok = (copy.Read(&base, baseOffset, kNTreeVersion, MakeNode, MemoryRead) == 0)
+		&& (copy.ReadDeltas(&deltas, deltaOffset, MakeNode, MemoryRead) == 0)
+		&& (deltaOffset == deltaSize)
+		&& (Describe(copy) == Describe(tree));
+
+	return Report("Write/WriteDelta/ReadDeltas", ok);
+}
+
+// Saves the tree on a worker thread while it is edited: the file must hold the tree as it
+// was when the save began, and a delta written afterwards must carry the edit.  A save
+// that fails must keep WriteDelta from writing deltas that would have no base.
+static bool CheckAsync(NTree& tree)
+{
+	MemoryFile base;
+	MemoryFile deltas;
+	long deltaSize = 0;
+	NTreeNodeRoot* root = tree.GetRoot();
+
+	root->GetChild(2)->InsertChild(tree.CreateNode<PlainSubclassNode>(NTreeNodeType('WORD'), tree.NewNodeID()));
+	string saved = Describe(tree);
+
+	future<long> save = tree.WriteAsync(&base, 0, kNTreeVersion, MemoryWrite, true);
+	root->GetChild(0)->InsertChild(tree.CreateNode<NTreeNode>(NTreeNodeType('LETR'), tree.NewNodeID()), 0);
+	long size = save.get();
+
+	bool ok = (size > 0) && (tree.WriteDelta(&deltas, deltaSize, kNTreeVersion, MemoryWrite) == 0);
+
+	{
+		NTree copy;
+		long offset = 0;
+
+		ok = ok && (copy.ReadIndexed(&base, offset, kNTreeVersion, MakeNode, MemoryRead) == 0)
+			&& (offset == size)
+			&& (Describe(copy) == saved);
+
+		offset = 0;
+		ok = ok && (copy.ReadDeltas(&deltas, offset, MakeNode, MemoryRead) == 0)
+			&& (Describe(copy) == Describe(tree));
+	}
+	Report("WriteAsync while editing, then WriteDelta", ok);
+
+	bool failed = (tree.WriteAsync(nullptr, 0, kNTreeVersion, FailingWrite).get() == -1)
+		&& (tree.WriteDelta(&deltas, deltaSize, kNTreeVersion, MemoryWrite) != 0)
+		&& !tree.IsTrackingChanges();
+
+	return Report("failed WriteAsync stops WriteDelta", failed) && ok;
+}
+
+static bool CheckXML(NTree& tree)
+{
+	const char* filename = "RoundTrip.xml";
+	NTree copy;
+	long offset = 0;
+
+	// Elements are turned back into nodes through the type table.
+	for (NTreeNodeType type : kRoundTripTypes)
+		copy.GetXMLTypes().Register(type, MakeNode);
+
+	bool ok = (tree.WriteXML(filename, offset, kNTreeVersion, nullptr) == 0)
+		&& (copy.ReadXML(filename, offset, kNTreeVersion, nullptr, nullptr) == 0)
+		&& (Describe(copy) == Describe(tree));
+	remove(filename);
+
+	return Report("WriteXML/ReadXML through NTreeXMLTypeTable", ok);
+}
+
+bool CheckRoundTrips()
+{
+	NTree tree;
+	bool matched = true;
+
+	Build(tree);
+
+	matched = CheckVersions(tree) && matched;
+	matched = CheckIndexed(tree) && matched;
+	matched = CheckIndexedVersions(tree) && matched;
+	matched = CheckDeltas(tree) && matched;
+	matched = CheckAsync(tree) && matched;
+	matched = CheckXML(tree) && matched;
+
+	return matched;
+}
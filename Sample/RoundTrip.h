@@ -0,0 +1,5 @@
+#pragma once
+
+// Saves a small tree every way NTree can and reads it back, checking that the tree
+// read matches the one saved.  Reports each mismatch; returns true if there were none.
+bool CheckRoundTrips();
@@ -2,6 +2,7 @@
 #include <string>
 
 #include "SpellChecker.h"
+#include "RoundTrip.h"
 
 using namespace std;
 
@@ -30,5 +31,8 @@ int main()
 	_RPT1(_CRT_WARN, "%s is spelled %s\n", wordToCheck.c_str(), correct ? "correctly" : "incorrectly");
 	
 	delete spellChecker;
+
+	bool roundTrips = CheckRoundTrips();
+	_RPT1(_CRT_WARN, "Saved trees %s when read back\n", roundTrips ? "matched" : "did not match");
 }
 
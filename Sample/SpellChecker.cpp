@@ -15,27 +15,27 @@
 
 using namespace std;
 
-unsigned short _nextNodeId = 0;
-
 SpellChecker::SpellChecker(string dictionary)
 {
 	Initialize();
 	_words = MakeStringVector(dictionary);
 	_tree = new NTree();
-	_addWordData = new AddWordData();
 
+	AddWordData data;
 	for (size_t i = 0; i < _words->size(); i += 1)
 	{
-		_addWordData->word = _words->at(i);
-		_addWordData->index = 0;
+		data.word = _words->at(i);
+		data.index = 0;
 		_tree->VisitAllNTreeNodes(
 			_tree->GetRoot(),
-			AddWord,
-			_addWordData,
+			[&data](NTreeNodePtr node) { return AddWord(node, data); },
 			NTree::kActionOnEntry,
 			NTree::kEntireTree
 		);
 	}
+
+	// The dictionary doesn't change from here on, so look words up in a flat copy.
+	_tree->Freeze(_frozen, FreezeTag);
 }
 
 SpellChecker::~SpellChecker()
@@ -47,15 +47,12 @@ SpellChecker::~SpellChecker()
 	}
 
 	delete _words;
-	delete _addWordData;
 }
 
 void SpellChecker::Initialize()
 {
-	_nextNodeId = 0;
 	_words = nullptr;
 	_tree = nullptr;
-	_addWordData = nullptr;
 }
 
 vector<string*>* SpellChecker::MakeStringVector(string& text)
@@ -75,43 +72,39 @@ vector<string*>* SpellChecker::MakeStringVector(string& text)
 }
 
 
-NTreeNodeID GetNextNodeId()
-{
-	_nextNodeId += 1;
-	return _nextNodeId;
-}
-
-
-bool SpellChecker::AddWord(NTreeNodePtr node, void* parm)
+// Walks down the path of letters for data.word, adding the letters and the word that are missing.
+// Nodes off the path have their children skipped, and once we have stepped onto the next
+// letter of the path its siblings are skipped.
+NTreeVisitResult SpellChecker::AddWord(NTreeNodePtr node, AddWordData& data)
 {
 	if (node->GetType() == NTreeNodeType('WORD'))
-		return false;
+		return kNTreeVisitSkipChildren;
 
-	AddWordData* data = static_cast<AddWordData*>(parm);
-	string* word = data->word;
-	short index = data->index;
+	string* word = data.word;
+	short index = data.index;
+	NTree* tree = node->GetTree();
 
 	if (!IsCorrectLineage(node, word, index))
-		return false;
+		return kNTreeVisitSkipChildren;
 
 	if (index == word->length())
 	{
 		if (FindChildWithWord(node, word) == nullptr)
-			node->InsertChild(new WordNode(word));
+			node->InsertChild(tree->CreateNode<WordNode>(tree->NewNodeID(), word));
 
-		return true;
+		return kNTreeVisitStop;
 	}
 
 	const char letter = word->c_str()[index];
 	if (FindChildWithLetter(node, letter) == nullptr)
 	{
-		NTreeNodePtr newNode = new LetterNode(letter);
+		NTreeNodePtr newNode = tree->CreateNode<LetterNode>(tree->NewNodeID(), letter);
 		node->InsertChild(newNode);
 	}
 
-	data->index += 1;
+	data.index += 1;
 
-	return false;
+	return kNTreeVisitSkipSiblings;
 }
 
 bool SpellChecker::IsCorrectLineage(NTreeNodePtr startNode, string* word, short index)
@@ -177,20 +170,41 @@ NTreeNode* SpellChecker::FindChildWithWord(NTreeNode* parent, string* word)
 	return exists ? child : nullptr;
 }
 
+// Letters are tagged with the letter and words with their string, so CheckSpelling
+// can walk the frozen copy without going back to the nodes.  The word tags are
+// pointers, so this copy must not be saved with NTreeFrozen::Save.
+NTreeFrozenTag SpellChecker::FreezeTag(NTreeNodePtr node)
+{
+	if (node->GetType() == NTreeNodeType('LETR'))
+		return NTreeFrozenTag(static_cast<unsigned char>(static_cast<LetterNode*>(node)->letter));
+
+	if (node->GetType() == NTreeNodeType('WORD'))
+		return reinterpret_cast<NTreeFrozenTag>(&static_cast<WordNode*>(node)->word);
+
+	return 0;
+}
+
 bool SpellChecker::CheckSpelling(string* word)
 {
 	size_t i = 0;
-	NTreeNode* node = _tree->GetRoot();
+	NTreeFrozenIndex node = _frozen.GetRoot();
 	char letter = 0x00;
 	while (i < word->length())
 	{
 		letter = word->c_str()[i];
-		node = FindChildWithLetter(node, letter);
-		if (node == nullptr) return false;
+		node = _frozen.FindChild(node, NTreeNodeType('LETR'), NTreeFrozenTag(static_cast<unsigned char>(letter)));
+		if (node == NTreeFrozen::kNone) return false;
 		i += 1;
 	}
 
-	return FindChildWithWord(node, word) != nullptr;
+	for (NTreeFrozenIndex child = _frozen.GetFirstChild(node); child != NTreeFrozen::kNone; child = _frozen.GetNextSibling(child))
+	{
+		if ((_frozen.GetType(child) == NTreeNodeType('WORD'))
+			&& (reinterpret_cast<const string*>(_frozen.GetTag(child))->compare(*word) == 0))
+			return true;
+	}
+
+	return false;
 }
 
 void SpellChecker::Dump()
@@ -9,16 +9,17 @@ private:
 
 	std::vector<std::string*>* _words;
 	NTree* _tree = new NTree();
-	AddWordData* _addWordData;
+	NTreeFrozen _frozen;
 
 	void Initialize();
 
 	std::vector<std::string*>* MakeStringVector(std::string& text);
-	static bool AddWord(NTreeNodePtr node, void* parm);
+	static NTreeVisitResult AddWord(NTreeNodePtr node, AddWordData& data);
 	static bool IsCorrectLineage(NTreeNodePtr startNode, std::string* word, short index);
 	static NTreeNode* FindChildWithLetter(NTreeNode* parent, char letter);
 	static NTreeNode* FindChildWithWord(NTreeNode* parent, std::string* word);
 	static bool DumpNode_ActionFunc(NTreeNodePtr inNode, void* inParam);
+	static NTreeFrozenTag FreezeTag(NTreeNodePtr node);
 
 public:
 
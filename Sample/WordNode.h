@@ -2,16 +2,21 @@
 #include <string>
 #include "../NTree/NTreeNode.h"
 
-extern NTreeNodeID GetNextNodeId();;
-
 class WordNode : public NTreeNode
 {
 public:
 
 std::string word;
 
-	WordNode(std::string* w) : NTreeNode(NTreeNodeType('WORD'), GetNextNodeId())
+	WordNode(NTreeNodeID id, std::string* w) : NTreeNode(NTreeNodeType('WORD'), id)
 	{
 		word.assign(*w);
 	}
+
+	NTreeNodePtr CloneForWrite(long) override
+	{
+		WordNode* copy = new WordNode(GetID(), &word);
+		copy->SetFlags(GetFlags());
+		return copy;
+	}
 };